@@ -0,0 +1,248 @@
+// Result cache, so a background job that has already run isn't run again (-C DIR)
+// A job is keyed on what its programs are and how they are run
+//      The contents of each stage's executable, its args, and the limits of the job
+//      Hashing an executable reads all of it, so its hash is kept with the device, inode, size and mtime it was taken at
+//      and only taken again once one of those changes
+// Each result is one file in DIR named for the hash of the key, a header, the whole key, then the output of the job
+// A hit is mapped and its key checked against the job's, two keys with the same hash are told apart
+// A file is written under a temporary name and renamed into place, so a shell reading it never sees half of one
+// Only background jobs are cached, theirs is the only output the shell keeps
+// Jobs killed by a signal, or with more output than a log keeps, aren't cached
+
+#include <sys/mman.h>
+#include "hash.h"
+
+// First bytes of a result file
+#define CACHE_MAGIC "NSCACHE1"
+// Starting size of the table of executables, doubles when full
+#define CACHE_INIT 64
+
+// Hash of the contents of an executable, and the file it was taken from
+struct exehash {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    unsigned long hash;
+
+    // Next executable in the same bucket
+    struct exehash *next;
+};
+
+// Start of a result file, followed by the key and then the output
+struct result {
+    char magic[8];
+    // Exit code of the job, the first non-zero one of its stages
+    int32_t status;
+    int32_t pad;
+    // Msec the job held a slot, the time a hit saves
+    int64_t ran;
+    uint64_t key_len;
+    uint64_t out_len;
+};
+
+// Cache of this shell
+struct cache {
+    // Directory the results are kept in, empty if there is no cache
+    char dir[4096];
+    // Why there is none
+    const char *off;
+
+    // Executables hashed so far, chained hash table keyed on the path
+    struct exehash **table;
+    int cap;
+    int count;
+
+    // Jobs answered from the cache, and the msec they ran for when they were cached
+    long hits;
+    long saved;
+    // Jobs looked up and not found, that had to run, and results stored
+    long misses;
+    long stored;
+    // Logs of jobs answered from the cache are kept under ids counting down from -1, they have no pid
+    int next_id;
+};
+
+
+// Opens the cache in dir, making it if it isn't there, no cache if dir is NULL
+void initcache(struct cache *c, const char *dir) {
+    c->dir[0] = '\0';
+    c->off = NULL;
+    c->cap = CACHE_INIT;
+    c->count = 0;
+    c->table = (struct exehash **)calloc(c->cap, sizeof(struct exehash *));
+    c->hits = c->saved = c->misses = c->stored = 0;
+    c->next_id = -1;
+
+    if (dir == NULL) {
+        c->off = "not asked for (-C DIR)";
+        return;
+    }
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        c->off = "unable to make the directory";
+        return;
+    }
+    snprintf(c->dir, sizeof(c->dir), "%s", dir);
+}
+
+// Bucket of the table for a given path
+struct exehash **exebucket(const char *path, struct cache *c) {
+    return &c->table[hashstr(path) & (c->cap - 1)];
+}
+
+// Double the table and rehash every executable into it
+void growcache(struct cache *c) {
+    struct exehash **old = c->table;
+    int old_cap = c->cap;
+
+    c->cap *= 2;
+    c->table = (struct exehash **)calloc(c->cap, sizeof(struct exehash *));
+    for (int i = 0; i < old_cap; i++) {
+        struct exehash *curr = old[i];
+        while (curr != NULL) {
+            struct exehash *next = curr->next;
+            struct exehash **b = exebucket(curr->path, c);
+            curr->next = *b;
+            *b = curr;
+            curr = next;
+        }
+    }
+    free(old);
+}
+
+// Hash of the contents of an executable, read again only if the file has changed since the last time
+// Returns 0 if it can't be read
+int hashexe(const char *path, unsigned long *hash, struct cache *c) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) { return 0; }
+
+    struct exehash *curr = *exebucket(path, c);
+    while (curr != NULL && strcmp(curr->path, path) != 0) { curr = curr->next; }
+    if (curr != NULL && curr->dev == st.st_dev && curr->ino == st.st_ino && curr->size == st.st_size
+        && curr->mtime.tv_sec == st.st_mtim.tv_sec && curr->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        *hash = curr->hash;
+        return 1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { return 0; }
+    char *map = (st.st_size != 0) ? (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (map == MAP_FAILED) { return 0; }
+    *hash = hashbytes(map, st.st_size);
+    if (map != NULL) { munmap(map, st.st_size); }
+
+    if (curr == NULL) {
+        if (c->count >= c->cap) { growcache(c); }
+        curr = (struct exehash *)malloc(sizeof(struct exehash));
+        curr->path = strdup(path);
+        struct exehash **b = exebucket(path, c);
+        curr->next = *b;
+        *b = curr;
+        c->count++;
+    }
+    curr->dev = st.st_dev;
+    curr->ino = st.st_ino;
+    curr->size = st.st_size;
+    curr->mtime = st.st_mtim;
+    curr->hash = *hash;
+    return 1;
+}
+
+// Builds the key of a job into a new block, every stage's executable hash and args, then the limits
+// Returns its length, 0 if an executable can't be read and the job can't be cached
+size_t jobkey(struct node *job, char **key, struct cache *c) {
+    size_t len;
+    FILE *f = open_memstream(key, &len);
+
+    for (struct node *stage = job; stage != NULL; stage = stage->pipe) {
+        unsigned long hash;
+        if (!hashexe(stage->name, &hash, c)) {
+            fclose(f);
+            free(*key);
+            *key = NULL;
+            return 0;
+        }
+        // Args are written with their terminators, so no two lists of them look the same
+        fprintf(f, "%016lx", hash);
+        for (char **arg = stage->args; *arg != NULL; arg++) { fwrite(*arg, 1, strlen(*arg) + 1, f); }
+        fputc('\n', f);
+    }
+    fprintf(f, "cpu=%d mem=%ld", job->cpu_max, job->mem_max);
+    fclose(f);
+    return len;
+}
+
+// Path of the result file of a key
+void resultpath(const char *key, size_t len, struct cache *c, char *path, size_t size) {
+    snprintf(path, size, "%s/%016lx.res", c->dir, hashbytes(key, len));
+}
+
+// Maps the result kept for a key, NULL if there is none
+// The mapping is size bytes, unmapped by the caller once it is done with it
+struct result *findresult(const char *key, size_t len, size_t *size, struct cache *c) {
+    char path[4200];
+    struct stat st;
+
+    resultpath(key, len, c, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { return NULL; }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct result)) {
+        close(fd);
+        return NULL;
+    }
+    struct result *res = (struct result *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (res == MAP_FAILED) { return NULL; }
+
+    // Anything else is another job with the same hash, or not a result at all
+    // Each length is checked against what is left of the file on its own, so a corrupt one can't wrap the sum around
+    size_t left = st.st_size - sizeof(struct result);
+    if (memcmp(res->magic, CACHE_MAGIC, sizeof(res->magic)) != 0 || res->key_len != len || res->key_len > left
+        || res->out_len != left - res->key_len || memcmp(res + 1, key, len) != 0) {
+        munmap(res, st.st_size);
+        return NULL;
+    }
+    *size = st.st_size;
+    return res;
+}
+
+// Output of a result, out_len bytes of it
+const char *resultoutput(struct result *res) {
+    return (const char *)(res + 1) + res->key_len;
+}
+
+// Keeps the result of a job, its output copied from the log file it was captured in
+// Returns 0 if it couldn't be written
+int storeresult(const char *key, size_t len, int status, long ran, int log, size_t out_len, struct cache *c) {
+    char path[4200], tmp[4300];
+
+    resultpath(key, len, c, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) { return 0; }
+
+    struct result res;
+    memset(&res, 0, sizeof(res));
+    memcpy(res.magic, CACHE_MAGIC, sizeof(res.magic));
+    res.status = status;
+    res.ran = ran;
+    res.key_len = len;
+    res.out_len = out_len;
+
+    int ok = write(fd, &res, sizeof(res)) == sizeof(res) && write(fd, key, len) == (ssize_t)len;
+    // The log goes straight from file to file in the kernel
+    off_t off = 0;
+    while (ok && (size_t)off < out_len) {
+        ssize_t n = sendfile(fd, log, &off, out_len - off);
+        if (n <= 0 && !(n < 0 && errno == EINTR)) { ok = 0; }
+    }
+    if (close(fd) != 0) { ok = 0; }
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return 0;
+    }
+    c->stored++;
+    return 1;
+}
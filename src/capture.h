@@ -0,0 +1,356 @@
+// Output capture for background jobs
+// A background job writes its stdout and stderr into a pipe, the shell moves it into a log file with splice()
+// The bytes go from the pipe into the page cache without ever being copied through the shell
+// Each log keeps the last LOG_MAX bytes, once it is full it wraps around like a ring buffer
+// Logs are kept in a directory made for this shell, and removed with it when the shell exits
+// Logs of finished jobs are kept up to LOG_TOTAL bytes in all, past that the oldest ones are removed
+
+#include <sys/sendfile.h>
+
+// Most bytes kept of a job's output
+#define LOG_MAX (1024 * 1024)
+// Most bytes kept of all the logs together, only finished ones are removed to stay under it
+#define LOG_TOTAL (64 * 1024 * 1024)
+// Starting size of the table, doubles when full
+#define CAPTURE_INIT 64
+
+// Output of one job
+struct capture {
+    // Pid the log is kept under, the first process of a pipeline
+    int pid;
+    // Read end of the pipe, -1 once every writer has closed it
+    int fd;
+    // Write end, only open in the shell until the job is started
+    int write_fd;
+    // Log file, open as long as the pipe is
+    int file;
+    // Bytes ever written, the log starts at written % LOG_MAX once it has wrapped
+    long written;
+
+    // Next capture in the same bucket
+    struct capture *next;
+    // Captures before and after it in the order they were kept, the oldest are removed first
+    struct capture *older;
+    struct capture *newer;
+};
+
+// Every job's output, chained hash table keyed on pid
+struct captures {
+    struct capture **table;
+    int cap;
+    int count;
+
+    // Captures still reading, indexed by the read end of their pipe
+    struct capture **by_fd;
+    int fd_cap;
+
+    // Directory the logs are kept in, empty until the first one
+    char dir[4096];
+
+    // Oldest and newest capture, bytes in all their logs and logs removed to keep it under LOG_TOTAL
+    struct capture *oldest;
+    struct capture *newest;
+    long bytes;
+    long evicted;
+};
+
+// Room for the path of a log, the directory and /pid.log
+#define LOG_PATH (sizeof(((struct captures *)0)->dir) + 32)
+
+
+// Initialize an empty set of captures
+void initcaptures(struct captures *c) {
+    c->cap = CAPTURE_INIT;
+    c->count = 0;
+    c->table = (struct capture **)calloc(c->cap, sizeof(struct capture *));
+    c->fd_cap = 0;
+    c->by_fd = NULL;
+    c->dir[0] = '\0';
+    c->oldest = c->newest = NULL;
+    c->bytes = c->evicted = 0;
+}
+
+// Bucket of the table for a given pid
+struct capture **capturebucket(int pid, struct captures *c) {
+    return &c->table[pid & (c->cap - 1)];
+}
+
+// Finds the output of the job with the given pid, NULL if none was kept
+struct capture *findcapture(int pid, struct captures *c) {
+    struct capture *curr = *capturebucket(pid, c);
+    while (curr != NULL && curr->pid != pid) { curr = curr->next; }
+    return curr;
+}
+
+// Finds the capture reading from the given fd, NULL if there is none
+struct capture *capturefd(int fd, struct captures *c) {
+    return (fd >= 0 && fd < c->fd_cap) ? c->by_fd[fd] : NULL;
+}
+
+// Bytes of a capture's log on disk
+long logsize(struct capture *cap) {
+    return (cap->written < LOG_MAX) ? cap->written : LOG_MAX;
+}
+
+// Path of the log of the given pid
+void logpath(int pid, struct captures *c, char *path, size_t size) {
+    snprintf(path, size, "%s/%d.log", c->dir, pid);
+}
+
+
+// Double the table and rehash every capture into it
+void growcaptures(struct captures *c) {
+    struct capture **old = c->table;
+    int old_cap = c->cap;
+
+    c->cap *= 2;
+    c->table = (struct capture **)calloc(c->cap, sizeof(struct capture *));
+    for (int i = 0; i < old_cap; i++) {
+        struct capture *curr = old[i];
+        while (curr != NULL) {
+            struct capture *next = curr->next;
+            struct capture **b = capturebucket(curr->pid, c);
+            curr->next = *b;
+            *b = curr;
+            curr = next;
+        }
+    }
+    free(old);
+}
+
+// Stops reading a capture, its log stays behind
+void closecapture(struct capture *cap, struct captures *c) {
+    if (cap->write_fd != -1) { close(cap->write_fd); }
+    if (cap->fd != -1) {
+        c->by_fd[cap->fd] = NULL;
+        close(cap->fd);
+    }
+    if (cap->file != -1) { close(cap->file); }
+    cap->write_fd = cap->fd = cap->file = -1;
+}
+
+// Forgets the capture of a pid and removes its log, if there is one
+void dropcapture(int pid, struct captures *c) {
+    struct capture **link = capturebucket(pid, c);
+    while (*link != NULL && (*link)->pid != pid) { link = &(*link)->next; }
+    if (*link == NULL) { return; }
+
+    struct capture *curr = *link;
+    *link = curr->next;
+    c->count--;
+    if (curr->older != NULL) { curr->older->newer = curr->newer; }
+    else { c->oldest = curr->newer; }
+    if (curr->newer != NULL) { curr->newer->older = curr->older; }
+    else { c->newest = curr->older; }
+    c->bytes -= logsize(curr);
+
+    char path[LOG_PATH];
+    logpath(pid, c, path, sizeof(path));
+    closecapture(curr, c);
+    unlink(path);
+    free(curr);
+}
+
+
+// Makes the directory the logs are kept in the first time it is needed
+// Returns 0 if it can't be made
+int capturedir(struct captures *c) {
+    if (c->dir[0] != '\0') { return 1; }
+
+    const char *tmp = getenv("TMPDIR");
+    snprintf(c->dir, sizeof(c->dir), "%s/newshell-XXXXXX", (tmp != NULL) ? tmp : "/tmp");
+    if (mkdtemp(c->dir) == NULL) {
+        c->dir[0] = '\0';
+        return 0;
+    }
+    return 1;
+}
+
+// Adds a capture to the table under the given pid
+void addcapture(struct capture *cap, int pid, struct captures *c) {
+    if (c->count >= c->cap) { growcaptures(c); }
+    cap->pid = pid;
+    struct capture **b = capturebucket(pid, c);
+    cap->next = *b;
+    *b = cap;
+    c->count++;
+
+    cap->newer = NULL;
+    cap->older = c->newest;
+    if (c->newest != NULL) { c->newest->newer = cap; }
+    else { c->oldest = cap; }
+    c->newest = cap;
+    c->bytes += logsize(cap);
+}
+
+// Removes the oldest logs of finished jobs until all of them fit in LOG_TOTAL
+// Logs still being written aren't touched, each of them is at most LOG_MAX
+void trimlogs(struct captures *c) {
+    struct capture *curr = c->oldest;
+    while (c->bytes > LOG_TOTAL && curr != NULL) {
+        struct capture *newer = curr->newer;
+        if (curr->fd == -1) {
+            dropcapture(curr->pid, c);
+            c->evicted++;
+        }
+        curr = newer;
+    }
+}
+
+// Opens a pipe for a job to write its output into, NULL if it can't be
+// The job gets write_fd as its stdout and stderr, then keepcapture() starts the log
+struct capture *opencapture(struct captures *c) {
+    if (!capturedir(c)) { return NULL; }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) { return NULL; }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    struct capture *cap = (struct capture *)malloc(sizeof(struct capture));
+    cap->pid = NO_PID;
+    cap->fd = fds[0];
+    cap->write_fd = fds[1];
+    cap->file = -1;
+    cap->written = 0;
+    cap->next = NULL;
+    return cap;
+}
+
+// Starts the log of a capture once its job has started, keeping it under the given pid
+// The shell's write end is closed, so the pipe ends when the job does
+// Returns 0 if the log couldn't be made, and the capture is freed
+int keepcapture(struct capture *cap, int pid, struct captures *c) {
+    close(cap->write_fd);
+    cap->write_fd = -1;
+
+    // A recycled pid takes over the old log
+    dropcapture(pid, c);
+
+    char path[LOG_PATH];
+    logpath(pid, c, path, sizeof(path));
+    cap->file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (cap->file < 0) {
+        closecapture(cap, c);
+        free(cap);
+        return 0;
+    }
+
+    // Index it by its fd so the event loop can find it
+    if (cap->fd >= c->fd_cap) {
+        int old_cap = c->fd_cap;
+        c->fd_cap = (cap->fd + 1) * 2;
+        c->by_fd = (struct capture **)realloc(c->by_fd, sizeof(struct capture *) * c->fd_cap);
+        memset(c->by_fd + old_cap, 0, sizeof(struct capture *) * (c->fd_cap - old_cap));
+    }
+    c->by_fd[cap->fd] = cap;
+
+    addcapture(cap, pid, c);
+    return 1;
+}
+
+// Keeps output that didn't come from a pipe as the finished log of the given id, like a job's
+// Returns 0 if the log couldn't be written
+int keepoutput(int id, const char *buf, size_t len, struct captures *c) {
+    if (!capturedir(c)) { return 0; }
+    dropcapture(id, c);
+
+    // Only the last LOG_MAX bytes, as if it had come through the ring
+    if (len > LOG_MAX) {
+        buf += len - LOG_MAX;
+        len = LOG_MAX;
+    }
+    char path[LOG_PATH];
+    logpath(id, c, path, sizeof(path));
+    int file = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (file < 0) { return 0; }
+    int ok = write(file, buf, len) == (ssize_t)len;
+    close(file);
+    if (!ok) {
+        unlink(path);
+        return 0;
+    }
+
+    struct capture *cap = (struct capture *)malloc(sizeof(struct capture));
+    cap->fd = cap->write_fd = cap->file = -1;
+    cap->written = len;
+    addcapture(cap, id, c);
+    trimlogs(c);
+    return 1;
+}
+
+
+// Moves whatever is in the pipe into the log, without it passing through the shell
+// Closes the capture once the job and everything it started has closed the pipe
+void drain(struct capture *cap, struct captures *c) {
+    while (cap->fd != -1) {
+        // Write at the ring position, up to where the log wraps
+        loff_t off = cap->written % LOG_MAX;
+        ssize_t n = splice(cap->fd, NULL, cap->file, &off, LOG_MAX - (size_t)off, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        if (n > 0) {
+            long had = logsize(cap);
+            cap->written += n;
+            c->bytes += logsize(cap) - had;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EINTR)) { return; }
+        // End of the pipe, or the log can't be written
+        else { closecapture(cap, c); }
+    }
+}
+
+// Copies part of a log to stdout, in the kernel if stdout lets us
+// A reply to a control socket client is built in memory, stdout has no fd then and it goes through stdio
+void printrange(int file, off_t off, off_t end) {
+    int direct = fileno(stdout) == STDOUT_FILENO;
+    while (off < end) {
+        ssize_t n = direct ? sendfile(STDOUT_FILENO, file, &off, end - off) : 0;
+        if (n > 0) { continue; }
+        if (n < 0 && errno == EINTR) { continue; }
+
+        // Not every stdout can be sent to, read it through a buffer instead
+        char buf[8192];
+        size_t want = (end - off < (off_t)sizeof(buf)) ? (size_t)(end - off) : sizeof(buf);
+        n = pread(file, buf, want, off);
+        if (n <= 0) { return; }
+        if (direct ? write(STDOUT_FILENO, buf, n) != n : fwrite(buf, 1, n, stdout) != (size_t)n) { return; }
+        off += n;
+    }
+}
+
+// Prints the output kept for a pid, oldest first
+// Returns 0 if none was kept
+int printlog(int pid, struct captures *c) {
+    struct capture *cap = findcapture(pid, c);
+    if (cap == NULL) { return 0; }
+
+    // Get whatever is still sitting in the pipe first
+    drain(cap, c);
+
+    char path[LOG_PATH];
+    logpath(pid, c, path, sizeof(path));
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0) { return 0; }
+
+    // Anything still buffered would come after the log
+    fflush(stdout);
+
+    // Once it has wrapped the oldest byte is right after the newest
+    off_t wrap = cap->written % LOG_MAX;
+    if (cap->written > LOG_MAX) {
+        printf("(only the last %d bytes of %ld were kept)\n", LOG_MAX, cap->written);
+        fflush(stdout);
+        printrange(file, wrap, LOG_MAX);
+    }
+    printrange(file, 0, (cap->written > LOG_MAX) ? wrap : cap->written);
+    close(file);
+    return 1;
+}
+
+
+// Stops every capture and removes the logs and their directory
+void removecaptures(struct captures *c) {
+    for (int i = 0; i < c->cap; i++) {
+        while (c->table[i] != NULL) { dropcapture(c->table[i]->pid, c); }
+    }
+    if (c->dir[0] != '\0') { rmdir(c->dir); }
+}
@@ -0,0 +1,230 @@
+// Resource control of jobs with cgroup v2
+// Every job runs in a group of its own, under a subtree the shell makes for itself
+//      <cgroup of the shell>/newshell-<pid>/job-<n>
+// A job can be limited with [cpu=percent,mem=size] after it, written to its cpu.max and memory.max
+// Nothing is controlled if cgroup v2 isn't mounted or we aren't allowed to make groups in it
+
+// Admission control from pressure stall information (PSI)
+// While /proc/pressure says tasks are stalled on CPU or memory, new jobs are held in the queue
+// Jobs that already started keep running, so the machine drains instead of thrashing
+
+#include <dirent.h>
+
+// Period of cpu.max in usec, a job limited to cpu=50 gets half of it
+#define CPU_PERIOD 100000
+// Msec between reads of /proc/pressure
+#define PSI_INTERVAL 100
+// Percent of the last 10 seconds some task was stalled, over which new jobs are held
+#define PSI_LIMIT 50.0
+
+// Subtree the jobs' groups are made in
+struct cgroups {
+    // Path of the subtree, empty if resource control is off
+    char root[4096];
+    // Why it is off
+    const char *off;
+
+    // Flags set if the cpu and memory controllers can be used in the jobs' groups
+    int cpu;
+    int memory;
+
+    // Groups made so far, names the next one
+    long made;
+};
+
+// Pressure on the machine, read at most every PSI_INTERVAL msec
+struct pressure {
+    int cpu_fd;
+    int memory_fd;
+    // Stall percent at which jobs are held, 0 to never hold them
+    double limit;
+
+    long checked;
+    double cpu;
+    double memory;
+    // Times new jobs were held back
+    long held;
+};
+
+
+// Writes a value into a file of a group, returns 1 if it was taken
+int writegroup(const char *dir, const char *file, const char *value) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) { return 0; }
+    ssize_t n = write(fd, value, strlen(value));
+    close(fd);
+    return n == (ssize_t)strlen(value);
+}
+
+// Reads a file of a group into buf, returns 1 if it could be read
+int readgroup(const char *dir, const char *file, char *buf, size_t size) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { return 0; }
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    buf[(n > 0) ? n : 0] = '\0';
+    return n >= 0;
+}
+
+// Returns 1 if the controller is in a space separated list of them
+int hascontroller(const char *list, const char *name) {
+    size_t len = strlen(name);
+    for (const char *s = strstr(list, name); s != NULL; s = strstr(s + 1, name)) {
+        if ((s == list || s[-1] == ' ') && (s[len] == ' ' || s[len] == '\n' || s[len] == '\0')) { return 1; }
+    }
+    return 0;
+}
+
+
+// Finds where cgroup v2 is mounted and makes the shell's subtree in its group
+void initcgroups(struct cgroups *g) {
+    char line[8192], mount[1024] = "", group[2048] = "";
+    int long_group = 0;
+    g->root[0] = '\0';
+    g->cpu = g->memory = 0;
+    g->made = 0;
+
+    // The mount whose type is cgroup2, it may not be at /sys/fs/cgroup
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        if (strstr(line, " - cgroup2 ") != NULL && sscanf(line, "%*d %*d %*s %*s %1023s", mount) == 1) { break; }
+        mount[0] = '\0';
+    }
+    if (f != NULL) { fclose(f); }
+
+    // The shell's own group in it, the line starting 0::
+    f = fopen("/proc/self/cgroup", "r");
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "0::", 3) == 0) {
+            // A path too long to keep would end up naming some other group
+            int len = (int)strcspn(line + 3, "\n");
+            if (len < (int)sizeof(group)) { snprintf(group, sizeof(group), "%.*s", len, line + 3); }
+            else { long_group = 1; }
+            break;
+        }
+    }
+    if (f != NULL) { fclose(f); }
+
+    if (long_group) {
+        g->off = "the shell's group has too long a path";
+        return;
+    }
+    if (mount[0] == '\0' || group[0] == '\0') {
+        g->off = "cgroup v2 is not mounted";
+        return;
+    }
+
+    char parent[3072];
+    snprintf(parent, sizeof(parent), "%s%s", mount, (strcmp(group, "/") == 0) ? "" : group);
+    snprintf(g->root, sizeof(g->root), "%s/newshell-%d", parent, getpid());
+    if (mkdir(g->root, 0755) != 0) {
+        g->root[0] = '\0';
+        g->off = "not allowed to make groups";
+        return;
+    }
+
+    // Ask for the controllers in our subtree, then hand them down to the jobs' groups
+    // The parent may not let us (it has processes of its own), then we get what it already gives
+    writegroup(parent, "cgroup.subtree_control", "+cpu +memory");
+    char controllers[1024];
+    if (readgroup(g->root, "cgroup.controllers", controllers, sizeof(controllers))) {
+        if (hascontroller(controllers, "cpu")) { g->cpu = writegroup(g->root, "cgroup.subtree_control", "+cpu"); }
+        if (hascontroller(controllers, "memory")) { g->memory = writegroup(g->root, "cgroup.subtree_control", "+memory"); }
+    }
+    g->off = NULL;
+}
+
+// Path of the group of a job
+void grouppath(long id, struct cgroups *g, char *path, size_t size) {
+    snprintf(path, size, "%s/job-%ld", g->root, id);
+}
+
+// Makes a group for a job, limited to cpu percent of one CPU and mem bytes (0 for no limit)
+// Returns the fd of its cgroup.procs to put the job's processes in, -1 if there is no group
+// id is set to the group, for removegroup() once the job is done
+int newgroup(struct cgroups *g, int cpu, long mem, long *id) {
+    char path[4160], value[64];
+    *id = 0;
+    if (g->root[0] == '\0') { return -1; }
+
+    grouppath(g->made + 1, g, path, sizeof(path));
+    if (mkdir(path, 0755) != 0) { return -1; }
+    *id = ++g->made;
+
+    if (cpu > 0) {
+        snprintf(value, sizeof(value), "%ld %d", (long)cpu * CPU_PERIOD / 100, CPU_PERIOD);
+        if (!g->cpu || !writegroup(path, "cpu.max", value)) { printf("Unable to limit the CPU of job %ld, no cpu controller\n", *id); }
+    }
+    if (mem > 0) {
+        snprintf(value, sizeof(value), "%ld", mem);
+        if (!g->memory || !writegroup(path, "memory.max", value)) { printf("Unable to limit the memory of job %ld, no memory controller\n", *id); }
+    }
+
+    char procs[4200];
+    snprintf(procs, sizeof(procs), "%s/cgroup.procs", path);
+    return open(procs, O_WRONLY | O_CLOEXEC);
+}
+
+// Removes the group of a job once its processes are gone
+void removegroup(long id, struct cgroups *g) {
+    if (id == 0) { return; }
+
+    char path[4160];
+    grouppath(id, g, path, sizeof(path));
+    rmdir(path);
+}
+
+// Removes the subtree, and any job groups still left in it
+void removecgroups(struct cgroups *g) {
+    if (g->root[0] == '\0') { return; }
+
+    DIR *dir = opendir(g->root);
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "job-", 4) == 0) { removegroup(atol(entry->d_name + 4), g); }
+    }
+    if (dir != NULL) { closedir(dir); }
+    rmdir(g->root);
+}
+
+
+// Opens /proc/pressure, jobs are held once a stall is over limit percent (0 to never hold them)
+void initpressure(struct pressure *p, double limit) {
+    p->cpu_fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+    p->memory_fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+    p->limit = (p->cpu_fd < 0 || p->memory_fd < 0) ? 0 : limit;
+    p->checked = 0;
+    p->cpu = p->memory = 0;
+    p->held = 0;
+}
+
+// Percent of the last 10 seconds some task was stalled, from a /proc/pressure file
+// The file stays open, every read of it is a fresh sample
+double stall(int fd) {
+    char buf[256];
+    double avg10 = 0;
+
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) { return 0; }
+    buf[n] = '\0';
+    sscanf(buf, "some avg10=%lf", &avg10);
+    return avg10;
+}
+
+// Returns 1 if the machine is too stalled to start another job
+int saturated(struct pressure *p, long time) {
+    if (p->limit <= 0) { return 0; }
+
+    if (time - p->checked >= PSI_INTERVAL) {
+        p->cpu = stall(p->cpu_fd);
+        p->memory = stall(p->memory_fd);
+        p->checked = time;
+    }
+    return p->cpu >= p->limit || p->memory >= p->limit;
+}
@@ -0,0 +1,161 @@
+// Control socket, so other programs can submit jobs and ask about them while the shell runs
+// A SOCK_SEQPACKET Unix socket, every message a client sends is one command line
+// and gets back one message with what the command printed
+// Clients are served by the shell's own epoll loop like everything else, every socket is non-blocking
+// so no client can hold up another one, or the reaping of the jobs
+//      kill only sends the signal and replies, the job is reaped like any other once it dies
+// A client that doesn't read its replies is dropped once its socket is full, rather than the shell waiting on it
+// A command longer than CONTROL_MSG, or a reply too big for one message, gets an error back instead
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// File the socket is bound to, relative to $HOME
+#define CONTROL_FILE ".newshell.sock"
+// Longest command a client can send in one message
+#define CONTROL_MSG (64 * 1024)
+// Most commands taken from one client each time the loop wakes up, so a busy one can't starve the rest
+#define CONTROL_BATCH 64
+// Connections waiting to be accepted
+#define CONTROL_BACKLOG 1024
+
+// Socket of this shell and its clients
+struct control {
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    // Listening socket, -1 if there is none
+    int fd;
+    // Why there is none
+    const char *off;
+
+    // Flag set for every fd that is a client, indexed by fd
+    char *clients;
+    int cap;
+    int count;
+
+    // Commands served, and clients dropped for not reading their replies
+    long requests;
+    long dropped;
+};
+
+
+// Binds the socket to path, taking it over if the shell that had it is gone
+// Only one shell can have it, another one that starts runs without one
+void initcontrol(struct control *c, const char *path) {
+    struct sockaddr_un addr;
+
+    c->fd = -1;
+    c->clients = NULL;
+    c->cap = c->count = 0;
+    c->requests = c->dropped = 0;
+    c->off = NULL;
+    snprintf(c->path, sizeof(c->path), "%s", path);
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        c->off = "the path is too long";
+        return;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path));
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        c->off = "unable to make a socket";
+        return;
+    }
+
+    // A socket nobody answers on is left from a shell that was killed
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (!bound && errno == EADDRINUSE) {
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno == ECONNREFUSED) { unlink(path); }
+        if (probe >= 0) { close(probe); }
+        bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    if (!bound || listen(fd, CONTROL_BACKLOG) != 0) {
+        c->off = (errno == EADDRINUSE) ? "another shell has it" : "unable to bind it";
+        close(fd);
+        return;
+    }
+    c->fd = fd;
+}
+
+// Returns 1 if the fd is a connected client
+int isclient(int fd, struct control *c) {
+    return fd >= 0 && fd < c->cap && c->clients[fd];
+}
+
+// Accepts every client waiting to connect, and has the epoll watch each one
+void acceptclients(struct control *c, int epoll_fd) {
+    int fd;
+    while ((fd = accept4(c->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (fd >= c->cap) {
+            int old_cap = c->cap;
+            c->cap = (fd + 1) * 2;
+            c->clients = (char *)realloc(c->clients, c->cap);
+            memset(c->clients + old_cap, 0, c->cap - old_cap);
+        }
+        c->clients[fd] = 1;
+        c->count++;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+// Hangs up on a client
+void dropclient(int fd, struct control *c) {
+    if (!isclient(fd, c)) { return; }
+    c->clients[fd] = 0;
+    c->count--;
+    close(fd);
+}
+
+// Reads the next command of a client into buf, without its newline
+// Returns its length, 0 if there is none waiting and -1 if the client has hung up
+// A message longer than size is cut off, its whole length is returned so it can be turned down instead of run
+ssize_t readrequest(int fd, char *buf, size_t size) {
+    ssize_t n = recv(fd, buf, size, MSG_DONTWAIT | MSG_TRUNC);
+    if (n < 0) { return (errno == EAGAIN || errno == EINTR) ? 0 : -1; }
+    // An empty message is the client closing its end
+    if (n == 0) { return -1; }
+    if ((size_t)n > size) { return n; }
+
+    while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == '\0')) { n--; }
+    // Nothing left of it, still answered so the client gets a reply to every message
+    if (n == 0) { buf[n++] = ' '; }
+    return n;
+}
+
+// Sends a client the reply to a command, hangs up on it if there is no room for it
+void sendreply(int fd, const char *reply, size_t len, struct control *c) {
+    c->requests++;
+    // An empty reply would read as the shell hanging up
+    if (len == 0) {
+        reply = "\n";
+        len = 1;
+    }
+    if (send(fd, reply, len, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)len) { return; }
+
+    // Bigger than any one message can be, the client is still reading so it gets told instead
+    if (errno == EMSGSIZE) {
+        char err[128];
+        int err_len = snprintf(err, sizeof(err), "Reply of %zu bytes is too big for one message, run it on the shell's terminal\n", len);
+        if (send(fd, err, err_len, MSG_DONTWAIT | MSG_NOSIGNAL) == err_len) { return; }
+    }
+
+    c->dropped++;
+    dropclient(fd, c);
+}
+
+// Hangs up on every client and removes the socket
+void closecontrol(struct control *c) {
+    if (c->fd == -1) { return; }
+
+    for (int fd = 0; fd < c->cap; fd++) { dropclient(fd, c); }
+    close(c->fd);
+    unlink(c->path);
+    c->fd = -1;
+}
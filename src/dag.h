@@ -0,0 +1,276 @@
+// Dependencies between jobs
+// A job given [id=name] can be waited on by later ones, [after=a+b] holds a job until a and b have exited successfully
+//      exec cc(1,1)[id=a] cc(1,1)[id=b] ld(1,1)[after=a+b]
+// Each job waiting on others is a task, with the jobs it still waits on and the jobs waiting on it
+// How many it still waits on is its in-degree, a held job is kept out of the heap until it drops to 0
+// If a job fails, every job waiting on it is cancelled, and every job waiting on those
+// A job can only wait on jobs that came before it, so the graph never has a cycle
+// The tail of a job is the work in the longest chain of jobs waiting on it, with more than one slot
+// the jobs with the longest tail run first (see before() in queue.h), so the critical path never waits
+
+#include "hash.h"
+
+// Starting size of the table of named tasks, doubles when full
+#define TASK_INIT 64
+
+// States of a task
+#define TASK_WAITING 0
+#define TASK_DONE 1
+#define TASK_FAILED 2
+
+// A job in the graph
+struct task {
+    // Name from [id=name], NULL if it wasn't given one
+    char *name;
+    int state;
+    // Leader of the job, NULL once it is done
+    struct node *job;
+
+    // Jobs it still waits on, the job is held until there are none
+    struct task **after;
+    int num_after;
+    int after_cap;
+    // Jobs waiting on it
+    struct task **dependents;
+    int num_dependents;
+    int dependents_cap;
+
+    // Next named task in the same bucket
+    struct task *next;
+};
+
+// Every job that waits or is waited on, named ones in a chained hash table keyed on the name
+// A named task is kept once its job is done, so later jobs can still come after it
+struct dag {
+    struct task **table;
+    int cap;
+    int count;
+
+    // Jobs held until the jobs they come after are done
+    long held;
+
+    // Tasks still to be visited when walking the graph
+    struct task **stack;
+    int stack_cap;
+};
+
+
+// Initialize an empty graph
+void initdag(struct dag *d) {
+    d->cap = TASK_INIT;
+    d->count = 0;
+    d->table = (struct task **)calloc(d->cap, sizeof(struct task *));
+    d->held = 0;
+    d->stack = NULL;
+    d->stack_cap = 0;
+}
+
+// Bucket of the table for a given name
+struct task **taskbucket(const char *name, size_t len, struct dag *d) {
+    return &d->table[hashbytes(name, len) & (d->cap - 1)];
+}
+
+// Finds the task with the given name, NULL if there is none
+struct task *findtask(struct view name, struct dag *d) {
+    struct task *curr = *taskbucket(name.s, name.len, d);
+    while (curr != NULL && !vieweq(name, curr->name)) { curr = curr->next; }
+    return curr;
+}
+
+// Double the table and rehash every named task into it
+void growdag(struct dag *d) {
+    struct task **old = d->table;
+    int old_cap = d->cap;
+
+    d->cap *= 2;
+    d->table = (struct task **)calloc(d->cap, sizeof(struct task *));
+    for (int i = 0; i < old_cap; i++) {
+        struct task *curr = old[i];
+        while (curr != NULL) {
+            struct task *next = curr->next;
+            struct task **b = taskbucket(curr->name, strlen(curr->name), d);
+            curr->next = *b;
+            *b = curr;
+            curr = next;
+        }
+    }
+    free(old);
+}
+
+// Adds a task to a growable array of them
+void pushtask(struct task ***list, int *count, int *cap, struct task *t) {
+    if (*count == *cap) {
+        *cap = (*cap == 0) ? 4 : *cap * 2;
+        *list = (struct task **)realloc(*list, sizeof(struct task *) * *cap);
+    }
+    (*list)[(*count)++] = t;
+}
+
+// Takes a task out of an array of them, the last one takes its place
+void removetask(struct task **list, int *count, struct task *t) {
+    for (int i = 0; i < *count; i++) {
+        if (list[i] == t) {
+            list[i] = list[--*count];
+            return;
+        }
+    }
+}
+
+
+// Makes a task for a job, not yet named or waiting on anything
+struct task *newtask(struct node *job) {
+    struct task *t = (struct task *)calloc(1, sizeof(struct task));
+    t->state = TASK_WAITING;
+    t->job = job;
+    job->task = t;
+    return t;
+}
+
+// Names a task, so later jobs can come after it
+// Returns 0 if the name is taken by a job that isn't done yet
+// A done job gives its name up, nothing can be waiting on it anymore
+int nametask(struct task *t, struct view name, struct dag *d) {
+    struct task **link = taskbucket(name.s, name.len, d);
+    while (*link != NULL && !vieweq(name, (*link)->name)) { link = &(*link)->next; }
+
+    if (*link != NULL) {
+        struct task *old = *link;
+        if (old->state == TASK_WAITING) { return 0; }
+        *link = old->next;
+        d->count--;
+        free(old->name);
+        free(old);
+    }
+
+    if (d->count >= d->cap) { growdag(d); }
+    t->name = strndup(name.s, name.len);
+    struct task **b = taskbucket(name.s, name.len, d);
+    t->next = *b;
+    *b = t;
+    d->count++;
+    return 1;
+}
+
+// Makes a task wait on another that came before it
+// Nothing to wait on if it is done, and the task can never run if it failed
+void addafter(struct task *t, struct task *before) {
+    if (before->state == TASK_FAILED) { t->state = TASK_FAILED; }
+    if (before->state != TASK_WAITING) { return; }
+
+    // Coming after the same job twice is still one edge
+    for (int i = 0; i < t->num_after; i++) {
+        if (t->after[i] == before) { return; }
+    }
+    pushtask(&t->after, &t->num_after, &t->after_cap, before);
+    pushtask(&before->dependents, &before->num_dependents, &before->dependents_cap, t);
+}
+
+// Raises the tail of every job a task waits on to cover the chain through it, and so on up the graph
+// A waiting job whose tail grows moves up in the heap
+void lengthen(struct task *t, struct dag *d, struct queue *q) {
+    int top = 0;
+    pushtask(&d->stack, &top, &d->stack_cap, t);
+
+    while (top != 0) {
+        struct task *curr = d->stack[--top];
+        int chain = curr->job->time + curr->job->tail;
+
+        for (int i = 0; i < curr->num_after; i++) {
+            struct node *job = curr->after[i]->job;
+            if (chain <= job->tail) { continue; }
+
+            job->tail = chain;
+            reorder(job, q);
+            pushtask(&d->stack, &top, &d->stack_cap, curr->after[i]);
+        }
+    }
+}
+
+// Frees a task once its job is done, unless it has a name to be found by
+void releasetask(struct task *t) {
+    free(t->after);
+    free(t->dependents);
+    t->after = t->dependents = NULL;
+    t->num_after = t->after_cap = 0;
+    t->num_dependents = t->dependents_cap = 0;
+    t->job->task = NULL;
+    t->job = NULL;
+    if (t->name == NULL) { free(t); }
+}
+
+// Takes a task out of the graph, no job waits on it or is waited on by it anymore
+void unlinktask(struct task *t) {
+    for (int i = 0; i < t->num_after; i++) {
+        struct task *before = t->after[i];
+        removetask(before->dependents, &before->num_dependents, t);
+    }
+    for (int i = 0; i < t->num_dependents; i++) {
+        struct task *dep = t->dependents[i];
+        removetask(dep->after, &dep->num_after, t);
+    }
+    t->num_after = t->num_dependents = 0;
+}
+
+// Pushes the jobs waiting on a task to be cancelled, each one only once
+void doom(struct task *t, struct dag *d, int *top) {
+    for (int i = 0; i < t->num_dependents; i++) {
+        struct task *dep = t->dependents[i];
+        if (dep->state != TASK_WAITING) { continue; }
+        dep->state = TASK_FAILED;
+        pushtask(&d->stack, top, &d->stack_cap, dep);
+    }
+}
+
+// Decides what to do with a job once its whole line is parsed
+// Returns 1 if it is held until the jobs it comes after are done, 0 if it can run now
+// and -1 if it never can, one of them failed, then the task is gone and the job is the caller's to drop
+int holdtask(struct task *t, struct dag *d) {
+    if (t->state == TASK_FAILED) {
+        unlinktask(t);
+        releasetask(t);
+        return -1;
+    }
+    if (t->num_after == 0) { return 0; }
+    d->held++;
+    return 1;
+}
+
+// Marks a task done once its job has finished, ok if every stage exited successfully
+// If it did, release is called with every job that no longer waits on anything
+// If it didn't, cancel is called with every job waiting on it, directly or not
+// The job itself is left to the caller, every cancelled one is gone when cancel returns
+void finishtask(struct task *t, int ok, struct dag *d, void (*release)(struct node *), void (*cancel)(struct node *)) {
+    int top = 0;
+
+    // Done, every job waiting on it has one less to wait on
+    if (ok) {
+        t->state = TASK_DONE;
+        for (int i = 0; i < t->num_dependents; i++) {
+            struct task *dep = t->dependents[i];
+            removetask(dep->after, &dep->num_after, t);
+            if (dep->num_after == 0) {
+                d->held--;
+                release(dep->job);
+            }
+        }
+        releasetask(t);
+        return;
+    }
+
+    // Failed, the jobs waiting on it go with it, and the ones waiting on those
+    t->state = TASK_FAILED;
+    doom(t, d, &top);
+    unlinktask(t);
+    releasetask(t);
+
+    while (top != 0) {
+        struct task *curr = d->stack[--top];
+        doom(curr, d, &top);
+        unlinktask(curr);
+
+        d->held--;
+        struct node *job = curr->job;
+        releasetask(curr);
+        cancel(job);
+    }
+}
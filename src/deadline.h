@@ -0,0 +1,124 @@
+// Deadlines of jobs, for the EDF scheduler
+// A job can be given one, p(n,qt)[deadline=500ms] is due 500 msec after it is submitted, [deadline=@SECS] at a Unix time
+// EDF runs the job due first, a new one takes the slot of the running job due last if it is due sooner
+// A job with a deadline is tested when it goes into the queue under EDF
+//      It has to finish before its deadline after the work due no later than it, spread over the slots, and its own predicted time
+//      One that can't is flagged, or rejected with -R
+// Every job with a deadline is counted as met or missed when it finishes, under whichever scheduler ran it
+// With -D a job is also given SCHED_DEADLINE when it starts, with its predicted time as runtime in a period that ends at its deadline
+//      The kernel only allows it with CAP_SYS_NICE, and only for processes that may run on every CPU, so not with -p
+
+#include <sys/syscall.h>
+
+// Longest SCHED_DEADLINE period in msec the kernel takes if it doesn't say, and where it says
+#define DL_PERIOD_MAX 4194
+#define DL_PERIOD_FILE "/proc/sys/kernel/sched_deadline_period_max_us"
+
+// Older headers don't have these
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+// What sched_setattr() takes, times in nsec
+struct dlattr {
+    uint32_t size;
+    uint32_t policy;
+    uint64_t flags;
+    int32_t nice;
+    uint32_t priority;
+    uint64_t runtime;
+    uint64_t deadline;
+    uint64_t period;
+};
+
+// Deadlines of this shell
+struct deadlines {
+    // Flag set if jobs that fail the test are rejected instead of flagged (-R)
+    int reject;
+    // Flag set if jobs are given SCHED_DEADLINE (-D), cleared once the kernel won't
+    int kernel;
+    // Why the kernel won't, NULL until it refuses
+    const char *off;
+    // Longest period in msec the kernel takes, a deadline further off is given the same share of a shorter one
+    long period_max;
+
+    // Jobs that failed the test and were flagged or rejected
+    long flagged;
+    long rejected;
+    // Processes given SCHED_DEADLINE, and the ones the kernel turned down as too much for the CPUs
+    long mapped;
+    long refused;
+};
+
+
+// Initialize the deadlines, reject and kernel as asked for
+void initdeadlines(struct deadlines *d, int reject, int kernel) {
+    d->reject = reject;
+    d->kernel = kernel;
+    d->off = kernel ? NULL : "not asked for (-D)";
+    d->flagged = d->rejected = 0;
+    d->mapped = d->refused = 0;
+
+    d->period_max = DL_PERIOD_MAX;
+    FILE *f = fopen(DL_PERIOD_FILE, "re");
+    long us;
+    if (f != NULL) {
+        if (fscanf(f, "%ld", &us) == 1 && us >= 1000) { d->period_max = us / 1000; }
+        fclose(f);
+    }
+}
+
+// Time in msec on the clock of time a job is due, from [deadline=...], -1 if it isn't one
+//      500, 500ms, 2s, 5m  - that long after time
+//      @SECS               - at a Unix time in seconds, like date +%s prints
+long parsedeadline(struct view v, long time) {
+    if (v.len == 0 || v.s[0] != '@') {
+        long in = viewmsec(v);
+        return (in > 0) ? time + in : -1;
+    }
+
+    long secs = 0;
+    if (v.len == 1) { return -1; }
+    for (size_t i = 1; i < v.len; i++) {
+        if (!isdigit((unsigned char)v.s[i])) { return -1; }
+        secs = secs * 10 + (v.s[i] - '0');
+    }
+
+    // Moved from the wall clock onto the clock of time
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    long at = time + (secs - wall.tv_sec) * 1000 - wall.tv_nsec / 1000000;
+    return (at > time) ? at : -1;
+}
+
+// Gives a process runtime msec of CPU in every period of left msec with SCHED_DEADLINE
+// A period longer than the kernel takes is cut down to the longest it does, with runtime cut down in step
+// Once the kernel says no for a reason other than the CPUs being full, no other process is tried
+void mapdeadline(pid_t pid, long runtime, long left, struct deadlines *d) {
+    if (!d->kernel || left <= 0) { return; }
+    if (runtime <= 0 || runtime > left) { runtime = left; }
+    if (left > d->period_max) {
+        runtime = runtime * d->period_max / left;
+        left = d->period_max;
+        if (runtime == 0) { runtime = 1; }
+    }
+
+    struct dlattr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.policy = SCHED_DEADLINE;
+    attr.runtime = (uint64_t)runtime * 1000000;
+    attr.deadline = attr.period = (uint64_t)left * 1000000;
+
+    if (syscall(SYS_sched_setattr, pid, &attr, 0) == 0) {
+        d->mapped++;
+        return;
+    }
+    if (errno == EBUSY) {
+        d->refused++;
+        return;
+    }
+    d->kernel = 0;
+    d->off = (errno == EPERM) ? "not permitted, it needs CAP_SYS_NICE and processes that aren't pinned (-p)"
+        : (errno == ENOSYS || errno == EINVAL) ? "not supported by the kernel" : "refused by the kernel";
+}
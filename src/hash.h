@@ -0,0 +1,21 @@
+// Hashing shared by the tables keyed on strings
+
+#ifndef HASH_H
+#define HASH_H
+
+// FNV-1a hash of the first len bytes of s
+unsigned long hashbytes(const char *s, size_t len) {
+    unsigned long h = 14695981039346656037UL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+
+// FNV-1a hash of a string
+unsigned long hashstr(const char *s) {
+    return hashbytes(s, strlen(s));
+}
+
+#endif
@@ -0,0 +1,554 @@
+// Journal of the queue, so a shell that dies doesn't take its jobs with it
+// Every job appends records to a file mapped into memory as it goes through the queue
+//      ENQUEUE - the programs of the job, how to run them and the jobs it comes after, once its whole line is parsed
+//      START   - the pid of each stage, and when the kernel started it so a reused pid isn't taken for it
+//      FINISH  - the job is gone, its records are dead
+// Appending is a copy into the mapping, the kernel writes it back on its own
+// A record survives the shell being killed, but not the machine going down before it is written back
+// Once the file is mostly dead records it is compacted, the live ones are copied into a new file that replaces it
+// A shell that starts with a journal replays it, see recover() in shell.c
+
+#include <sys/mman.h>
+#include <sys/file.h>
+
+// File the journal is kept in, relative to $HOME
+#define JOURNAL_FILE ".newshell_journal"
+// First bytes of the file
+#define JOURNAL_MAGIC "NSJRNL2"
+// Records start after the header, at this offset
+#define JOURNAL_START 128
+// Starting size of the file, doubles when full
+#define JOURNAL_INIT (64 * 1024)
+// Size past which the journal is compacted, once less than a quarter of it is live
+#define JOURNAL_COMPACT (4 * 1024 * 1024)
+// Starting size of the table of jobs, doubles when full
+#define ENTRY_INIT 1024
+// Most ids between the oldest live job and the next, more than that and the header is taken to be garbage
+#define JOURNAL_IDS (1L << 30)
+
+// Types of records
+#define JOURNAL_ENQUEUE 1
+#define JOURNAL_START_JOB 2
+#define JOURNAL_FINISH 3
+
+// Records are 8 byte aligned, so their fields can be read in place
+#define RECORD_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+// Start of the file
+struct journalhead {
+    char magic[8];
+    // Bytes of the file in use, a record is only part of the journal once this is past it
+    uint64_t used;
+    // Ids of the oldest job that may still be live, and of the next job
+    uint64_t base;
+    uint64_t next;
+    // Boot the journal was written in, pids from another boot mean nothing
+    char boot[40];
+};
+
+// Header of every record
+struct record {
+    // Bytes of the whole record, with padding
+    uint32_t len;
+    uint32_t type;
+    // Job the record is about
+    uint64_t id;
+    // When the job arrived for ENQUEUE, when it started for START, in msec
+    int64_t time;
+    // Number of stages after the header
+    int32_t stages;
+    // ENQUEUE, flag set if the job runs in the background, and its cgroup limits
+    int32_t bg;
+    int64_t mem_max;
+    int32_t cpu_max;
+    // ENQUEUE, number of jobs it comes after
+    int32_t deps;
+};
+// ENQUEUE is followed by the ids of the jobs it comes after as uint64_t, then its name from [id=] with its terminator,
+// then each stage's number of args as a uint16_t, then the args with their terminators
+// START is followed by a stagepid for each stage
+
+// Pid of a stage, NO_PID if it couldn't be started
+struct stagepid {
+    int32_t pid;
+    int32_t pad;
+    // Start time from /proc/<pid>/stat
+    uint64_t start;
+};
+
+// Where the live records of a job are, 0 if it has none
+struct jentry {
+    size_t enqueued;
+    size_t started;
+};
+
+// Journal of this shell
+struct journal {
+    char path[4096];
+    // File, -1 if there is no journal
+    int fd;
+    char *map;
+    size_t cap;
+    struct journalhead *head;
+
+    // Records of each job, indexed by id - base
+    struct jentry *entries;
+    long entry_cap;
+    // Bytes of live records
+    size_t live;
+
+    // Flag set if the journal is from before the machine last booted
+    int rebooted;
+    // Flag set while the last shell's jobs are replayed, it is only compacted once that is done
+    int replaying;
+    // Why there is no journal
+    const char *off;
+};
+
+
+// When a process started, in clock ticks since boot, 0 if there is no such process
+// Along with the pid it tells a process apart from a later one that got the same pid
+unsigned long long procstart(int pid) {
+    char path[64], buf[1024];
+    unsigned long long start = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { return 0; }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) { return 0; }
+    buf[n] = '\0';
+
+    // The name can have spaces and parens in it, the fields start after the last )
+    // starttime is the 22nd field, the 20th after the name
+    char *s = strrchr(buf, ')');
+    if (s == NULL) { return 0; }
+    sscanf(s + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu", &start);
+    return start;
+}
+
+// Id of the current boot, so a journal can tell if it outlived one
+void bootid(char *buf, size_t size) {
+    memset(buf, 0, size);
+    int fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { return; }
+    if (read(fd, buf, size - 1) < 0) { buf[0] = '\0'; }
+    close(fd);
+}
+
+
+// Record at an offset of the file
+struct record *recordat(struct journal *j, size_t off) {
+    return (struct record *)(j->map + off);
+}
+
+// Records of a job, NULL if the id isn't in the table
+struct jentry *entryof(struct journal *j, long id) {
+    long i = id - (long)j->head->base;
+    return (i >= 0 && i < j->entry_cap) ? &j->entries[i] : NULL;
+}
+
+// Maps size bytes of the file, growing or shrinking it to that
+int mapjournal(struct journal *j, size_t size) {
+    if (ftruncate(j->fd, size) != 0) { return 0; }
+
+    void *map = (j->map == NULL) ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0) : mremap(j->map, j->cap, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) { return 0; }
+    j->map = (char *)map;
+    j->cap = size;
+    j->head = (struct journalhead *)map;
+    return 1;
+}
+
+// Makes the table big enough for every id up to next
+void growentries(struct journal *j) {
+    long need = j->head->next - j->head->base + 1;
+    if (need <= j->entry_cap) { return; }
+
+    long old_cap = j->entry_cap;
+    while (j->entry_cap < need) { j->entry_cap = (j->entry_cap == 0) ? ENTRY_INIT : j->entry_cap * 2; }
+    j->entries = (struct jentry *)realloc(j->entries, sizeof(struct jentry) * j->entry_cap);
+    memset(j->entries + old_cap, 0, sizeof(struct jentry) * (j->entry_cap - old_cap));
+}
+
+// Forgets the records of a job, they are dead
+void dropentry(struct journal *j, struct jentry *e) {
+    if (e->enqueued != 0) { j->live -= recordat(j, e->enqueued)->len; }
+    if (e->started != 0) { j->live -= recordat(j, e->started)->len; }
+    e->enqueued = e->started = 0;
+}
+
+
+// Makes room for a record at the end of the journal, with size bytes after its header
+// It isn't part of the journal until commitrecord(), NULL if the file can't grow
+struct record *newrecord(struct journal *j, int type, long id, size_t size) {
+    size_t len = RECORD_ALIGN(sizeof(struct record) + size);
+    if (j->head->used + len > j->cap) {
+        size_t cap = j->cap;
+        while (j->head->used + len > cap) { cap *= 2; }
+        if (!mapjournal(j, cap)) { return NULL; }
+    }
+
+    struct record *r = recordat(j, j->head->used);
+    memset(r, 0, len);
+    r->len = len;
+    r->type = type;
+    r->id = id;
+    return r;
+}
+
+// Adds a record that has been written to the journal, and to the table of its job
+void commitrecord(struct journal *j, struct record *r) {
+    size_t off = (char *)r - j->map;
+    struct jentry *e = entryof(j, r->id);
+
+    if (r->type == JOURNAL_ENQUEUE) { e->enqueued = off; }
+    else if (r->type == JOURNAL_START_JOB) { e->started = off; }
+    if (r->type == JOURNAL_FINISH) { dropentry(j, e); }
+    else { j->live += r->len; }
+
+    // Only now is the record there for whoever replays the journal
+    j->head->used += r->len;
+}
+
+// Builds the table of jobs from the records, stopping at the first that doesn't make sense
+// That can only be the end of one the shell was killed in the middle of writing
+void scanjournal(struct journal *j) {
+    size_t off = JOURNAL_START;
+
+    growentries(j);
+    while (off + sizeof(struct record) <= j->head->used) {
+        struct record *r = recordat(j, off);
+        if (r->len < sizeof(struct record) || r->len % 8 != 0 || off + r->len > j->head->used) { break; }
+        if (r->id < j->head->base || r->id >= j->head->next) { break; }
+        if (r->type == JOURNAL_ENQUEUE && (r->deps < 0 || sizeof(struct record) + sizeof(uint64_t) * r->deps >= r->len)) { break; }
+
+        struct jentry *e = entryof(j, r->id);
+        if (r->type == JOURNAL_ENQUEUE) { e->enqueued = off; }
+        else if (r->type == JOURNAL_START_JOB && e->enqueued != 0) { e->started = off; }
+        else if (r->type == JOURNAL_FINISH) { dropentry(j, e); }
+        else { break; }
+        if (r->type != JOURNAL_FINISH) { j->live += r->len; }
+
+        off += r->len;
+    }
+    j->head->used = off;
+}
+
+// Returns 1 if the mapped file is a journal that can be replayed
+int validjournal(struct journal *j) {
+    struct journalhead *h = j->head;
+    return memcmp(h->magic, JOURNAL_MAGIC, sizeof(h->magic)) == 0 && h->used >= JOURNAL_START && h->used <= j->cap
+        && h->base >= 1 && h->next >= h->base && h->next - h->base <= JOURNAL_IDS;
+}
+
+// Starts a journal in the file just mapped, with nothing in it
+void resetjournal(struct journal *j) {
+    memset(j->map, 0, JOURNAL_START);
+    memcpy(j->head->magic, JOURNAL_MAGIC, sizeof(j->head->magic));
+    j->head->used = JOURNAL_START;
+    j->head->base = j->head->next = 1;
+    bootid(j->head->boot, sizeof(j->head->boot));
+}
+
+
+// Opens the journal in path, making it if there isn't one
+// Only one shell can have a journal, another one that starts runs without one
+void initjournal(struct journal *j, const char *path) {
+    struct stat st;
+    char boot[40];
+
+    snprintf(j->path, sizeof(j->path), "%s", path);
+    j->map = NULL;
+    j->cap = 0;
+    j->entries = NULL;
+    j->entry_cap = 0;
+    j->live = 0;
+    j->rebooted = 0;
+    j->replaying = 0;
+    j->off = NULL;
+
+    j->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (j->fd < 0) {
+        j->off = "unable to open it";
+        return;
+    }
+    if (flock(j->fd, LOCK_EX | LOCK_NB) != 0) {
+        close(j->fd);
+        j->fd = -1;
+        j->off = "another shell has it";
+        return;
+    }
+
+    // Anything that isn't a journal is started over
+    if (fstat(j->fd, &st) != 0 || st.st_size < JOURNAL_INIT || !mapjournal(j, st.st_size) || !validjournal(j)) {
+        if (!mapjournal(j, JOURNAL_INIT)) {
+            close(j->fd);
+            j->fd = -1;
+            j->off = "unable to map it";
+            return;
+        }
+        resetjournal(j);
+    }
+
+    bootid(boot, sizeof(boot));
+    j->rebooted = memcmp(boot, j->head->boot, sizeof(boot)) != 0;
+    scanjournal(j);
+}
+
+// Copies the live records into a new file that takes the place of the journal
+// The jobs keep their ids, so nothing in the queue has to change
+void compactjournal(struct journal *j) {
+    if (j->fd == -1) { return; }
+
+    char tmp[4200];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", j->path);
+    struct journal new;
+    new.fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (new.fd < 0) { return; }
+    flock(new.fd, LOCK_EX | LOCK_NB);
+
+    // Room for what is live now, and as much again before it has to grow
+    size_t cap = JOURNAL_INIT;
+    while (cap < JOURNAL_START + j->live * 2) { cap *= 2; }
+    new.map = NULL;
+    if (!mapjournal(&new, cap)) {
+        close(new.fd);
+        unlink(tmp);
+        return;
+    }
+    resetjournal(&new);
+
+    // Ids before the oldest live job are gone for good
+    long id = j->head->base, next = j->head->next;
+    while (id < next && entryof(j, id)->enqueued == 0) { id++; }
+    new.head->base = id;
+    new.head->next = next;
+    new.entries = NULL;
+    new.entry_cap = 0;
+    new.live = 0;
+    growentries(&new);
+
+    // Each live job's records, ENQUEUE then START
+    size_t off = JOURNAL_START;
+    for (; id < next; id++) {
+        struct jentry *e = entryof(j, id), *new_e = entryof(&new, id);
+        if (e->enqueued == 0) { continue; }
+
+        size_t offs[2] = { e->enqueued, e->started };
+        size_t *new_offs[2] = { &new_e->enqueued, &new_e->started };
+        for (int k = 0; k < 2 && offs[k] != 0; k++) {
+            struct record *r = recordat(j, offs[k]);
+            memcpy(new.map + off, r, r->len);
+            *new_offs[k] = off;
+            off += r->len;
+            new.live += r->len;
+        }
+    }
+    new.head->used = off;
+
+    // It only replaces the old one once it is all there
+    if (rename(tmp, j->path) != 0) {
+        munmap(new.map, new.cap);
+        close(new.fd);
+        free(new.entries);
+        unlink(tmp);
+        return;
+    }
+    munmap(j->map, j->cap);
+    close(j->fd);
+    free(j->entries);
+
+    j->fd = new.fd;
+    j->map = new.map;
+    j->cap = new.cap;
+    j->head = new.head;
+    j->entries = new.entries;
+    j->entry_cap = new.entry_cap;
+    j->live = new.live;
+    j->rebooted = 0;
+}
+
+// Compacts the journal once most of it is dead records
+void maybecompact(struct journal *j) {
+    if (!j->replaying && j->head->used > JOURNAL_COMPACT && j->live * 4 < j->head->used) { compactjournal(j); }
+}
+
+// Compacts the journal and closes it, whatever is still live in it is picked up by the next shell
+void closejournal(struct journal *j) {
+    if (j->fd == -1) { return; }
+
+    compactjournal(j);
+    munmap(j->map, j->cap);
+    close(j->fd);
+    free(j->entries);
+    j->fd = -1;
+}
+
+
+// Writes a job into the journal once all its stages are in the queue, giving it an id
+void journalenqueue(struct journal *j, struct node *leader) {
+    if (j->fd == -1) { return; }
+
+    // The jobs it comes after and its name, then every stage's arg count and args, without the & that bg stands for
+    struct task *t = leader->task;
+    int deps = (t != NULL) ? t->num_after : 0;
+    size_t size = sizeof(uint64_t) * deps + ((t != NULL && t->name != NULL) ? strlen(t->name) : 0) + 1;
+    int stages = 0;
+    for (struct node *stage = leader; stage != NULL; stage = stage->pipe) {
+        size += sizeof(uint16_t);
+        for (int i = 0; stage->args[i] != NULL; i++) { size += strlen(stage->args[i]) + 1; }
+        stages++;
+    }
+
+    long id = j->head->next;
+    struct record *r = newrecord(j, JOURNAL_ENQUEUE, id, size);
+    if (r == NULL) { return; }
+    r->time = leader->arrived;
+    r->stages = stages;
+    r->bg = leader->bg;
+    r->cpu_max = leader->cpu_max;
+    r->mem_max = leader->mem_max;
+    r->deps = deps;
+
+    uint64_t *after = (uint64_t *)(r + 1);
+    for (int i = 0; i < deps; i++) { after[i] = t->after[i]->job->entry; }
+    char *p = (char *)(after + deps);
+    if (t != NULL && t->name != NULL) { p = stpcpy(p, t->name); }
+    *p++ = '\0';
+    for (struct node *stage = leader; stage != NULL; stage = stage->pipe) {
+        uint16_t argc = 0;
+        while (stage->args[argc] != NULL) { argc++; }
+        memcpy(p, &argc, sizeof(argc));
+        p += sizeof(argc);
+
+        for (int i = 0; i < argc; i++) {
+            size_t len = strlen(stage->args[i]) + 1;
+            memcpy(p, stage->args[i], len);
+            p += len;
+        }
+    }
+
+    j->head->next++;
+    growentries(j);
+    commitrecord(j, r);
+    leader->entry = id;
+}
+
+// Writes the pids of a job that has just started into the journal
+void journalstart(struct journal *j, struct node *leader) {
+    if (j->fd == -1 || leader->entry == 0) { return; }
+
+    int stages = 0;
+    for (struct node *stage = leader; stage != NULL; stage = stage->pipe) { stages++; }
+
+    struct record *r = newrecord(j, JOURNAL_START_JOB, leader->entry, sizeof(struct stagepid) * stages);
+    if (r == NULL) { return; }
+    r->time = leader->first_started;
+    r->stages = stages;
+
+    struct stagepid *pids = (struct stagepid *)(r + 1);
+    for (struct node *stage = leader; stage != NULL; stage = stage->pipe, pids++) {
+        pids->pid = stage->pid;
+        pids->start = (stage->pid != NO_PID) ? procstart(stage->pid) : 0;
+    }
+    commitrecord(j, r);
+}
+
+// Writes that a job is gone into the journal, it won't be replayed
+void journalfinish(struct journal *j, long id) {
+    if (j->fd == -1 || id == 0) { return; }
+
+    struct jentry *e = entryof(j, id);
+    if (e == NULL || e->enqueued == 0) { return; }
+
+    struct record *r = newrecord(j, JOURNAL_FINISH, id, 0);
+    if (r == NULL) { return; }
+    commitrecord(j, r);
+    maybecompact(j);
+}
+
+
+// Forgets that a job started, the reboot killed it before it was done so it has to run again
+void journalrequeue(struct journal *j, long id) {
+    struct jentry *e = entryof(j, id);
+    if (e == NULL || e->started == 0) { return; }
+
+    j->live -= recordat(j, e->started)->len;
+    e->started = 0;
+}
+
+
+// Finds the records of a live job, returns 0 if it has none
+// started is set to NULL if the job never started
+int journalentry(struct journal *j, long id, struct record **enqueued, struct record **started) {
+    struct jentry *e = entryof(j, id);
+    if (e == NULL || e->enqueued == 0) { return 0; }
+
+    *enqueued = recordat(j, e->enqueued);
+    *started = (e->started != 0) ? recordat(j, e->started) : NULL;
+    return 1;
+}
+
+// Rebuilds the nodes of a job from its ENQUEUE record, not yet in the queue
+// The args are views into the mapping, newnode() copies them out of it
+struct node *journaljob(struct record *r, struct queue *q) {
+    struct view args[MAX_ARGS + 1];
+    struct node *leader = NULL, *prev = NULL;
+    char *p = (char *)(r + 1), *end = (char *)r + r->len;
+    p += sizeof(uint64_t) * r->deps;
+    p += strnlen(p, end - p) + 1;
+
+    for (int i = 0; i < r->stages && p + sizeof(uint16_t) <= end; i++) {
+        uint16_t argc;
+        int n = 0;
+        memcpy(&argc, p, sizeof(argc));
+        p += sizeof(argc);
+
+        for (int k = 0; k < argc && p < end; k++) {
+            size_t len = strnlen(p, end - p);
+            if (n < MAX_ARGS) {
+                args[n].s = p;
+                args[n++].len = len;
+            }
+            p += len + 1;
+        }
+        if (n == 0) { continue; }
+
+        // The & only goes back on the last stage, pipeto() hands it down to the rest
+        if (r->bg && i == r->stages - 1) {
+            args[n].s = (char *)"&";
+            args[n++].len = 1;
+        }
+        prev = (prev == NULL) ? newnode(args, n, q) : pipeto(prev, args, n, q);
+        prev->arrived = r->time;
+        if (leader == NULL) { leader = prev; }
+    }
+    if (leader == NULL) { return NULL; }
+
+    leader->cpu_max = r->cpu_max;
+    leader->mem_max = r->mem_max;
+    leader->entry = r->id;
+    return leader;
+}
+
+// Ids of the jobs a job comes after, from its ENQUEUE record, there are r->deps of them
+uint64_t *journaldeps(struct record *r) {
+    return (uint64_t *)(r + 1);
+}
+
+// Name of a job from its ENQUEUE record, empty if it wasn't given one
+char *journalname(struct record *r) {
+    return (char *)(journaldeps(r) + r->deps);
+}
+
+// Pid of a stage of a job from its START record, and when it started
+int stagepid(struct record *started, int stage, unsigned long long *start) {
+    *start = 0;
+    if (stage >= started->stages) { return NO_PID; }
+
+    struct stagepid *pids = (struct stagepid *)(started + 1);
+    *start = pids[stage].start;
+    return pids[stage].pid;
+}
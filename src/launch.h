@@ -0,0 +1,227 @@
+// Ways to start a process, picked once when the shell starts
+// fork  - fork() then execv(), copies the page tables of the whole shell
+// spawn - posix_spawn(), glibc starts the child with clone(CLONE_VM | CLONE_VFORK)
+// vfork - clone(CLONE_VM | CLONE_VFORK) ourselves, the child borrows our memory until it execs
+// spawn and vfork cost the same no matter how much memory the shell has resident
+// The child's stdin/stdout/stderr can be given as fds, for pipelines and output capture
+// Each process can come with a pidfd, to signal and reap it without ever naming a pid that may have been reused
+
+#include <spawn.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <errno.h>
+
+#define LAUNCH_FORK 0
+#define LAUNCH_SPAWN 1
+#define LAUNCH_VFORK 2
+#define NUM_LAUNCHERS 3
+
+// No CPU to pin the process to
+#define NO_CPU -1
+
+// Stack for the vfork child, only used until it execs
+#define LAUNCH_STACK (64 * 1024)
+
+// waitid() id type for a pidfd, older headers don't have it
+#define IDTYPE_PIDFD 3
+// Wait status of a process that died without being reaped, it wasn't our child so how it ended isn't known
+#define STATUS_UNKNOWN -1
+
+// Names of the launchers, indexed by launcher
+const char *launch_names[] = { "fork", "spawn", "vfork" };
+
+extern char **environ;
+
+
+// What the child needs to know to start the process
+// Kept in one place so the vfork child can get it through a single pointer
+struct launch {
+    char *name;
+    char **args;
+    // Detach from the terminal and close whichever of stdin/stdout/stderr isn't given an fd
+    int bg;
+    // CPU to pin the process to, NO_CPU if none
+    int cpu;
+    // Fds to put on stdin, stdout and stderr, -1 (or no array) to leave them be
+    int *fds;
+    // cgroup.procs of the group to run the process in, -1 if none
+    int group_fd;
+};
+
+// Fd the child should get as its fd i, -1 if it keeps the shell's
+int stdiofd(struct launch *l, int i) {
+    return (l->fds != NULL) ? l->fds[i] : -1;
+}
+
+
+// Opens a pidfd for a process, it doesn't have to be our child
+int pidfdopen(int pid) {
+    return syscall(SYS_pidfd_open, pid, 0);
+}
+
+// Sends a signal to the process of a pidfd
+int pidfdsignal(int pidfd, int sig) {
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+}
+
+// Reaps the dead child of a pidfd, like wait4() does for a pid, without waiting for it
+// Returns 1 and its wait status in status, 0 if it hasn't died yet, -1 if it can't be reaped because it isn't our child
+int pidfdreap(int pidfd, int *status, struct rusage *usage) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (syscall(SYS_waitid, IDTYPE_PIDFD, pidfd, &info, WEXITED | WNOHANG, usage) != 0) { return (errno == ECHILD) ? -1 : 0; }
+    if (info.si_pid == 0) { return 0; }
+
+    *status = (info.si_code == CLD_EXITED) ? W_EXITCODE(info.si_status, 0) : W_EXITCODE(0, info.si_status);
+    return 1;
+}
+
+// Returns 1 if the process of a pidfd has died, whether or not it is our child
+int pidfddead(int pidfd) {
+    struct pollfd pfd = { pidfd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 1;
+}
+
+
+// Pins a process to a CPU, 0 for the calling process
+void pincpu(pid_t pid, int cpu) {
+    if (cpu == NO_CPU) { return; }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(pid, sizeof(set), &set);
+}
+
+
+// Sets up the new process and runs the program, only returns if that fails
+// Only makes system calls, so it is safe to run in a child that shares our memory
+void childsetup(struct launch *l) {
+    // We may have started the child with signals blocked, don't pass them on
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    // Keep the process on the CPU of its slot, and in the group of its job
+    pincpu(0, l->cpu);
+    // If it can't be put in its group, it runs without the limits
+    if (l->group_fd != -1 && write(l->group_fd, "0", 1) != 1) { l->group_fd = -1; }
+
+    // Detach the process from the terminal if it is in the background
+    if (l->bg) { setsid(); }
+
+    // Hook up its pipes, a background process gets no input/output in the terminal
+    for (int i = STDIN_FILENO; i <= STDERR_FILENO; i++) {
+        if (stdiofd(l, i) != -1) { dup2(stdiofd(l, i), i); }
+        else if (l->bg) { close(i); }
+    }
+
+    // Run the process/program based on the name
+    execv(l->name, l->args);
+}
+
+
+// Start function of the vfork child
+int vforkchild(void *arg) {
+    childsetup((struct launch *)arg);
+    // Should never get here, if we do, something went wrong
+    // _exit, the child shares our memory so it can't run our atexit handlers or flush our stdio
+    _exit(-1);
+}
+
+
+// fork() then execv()
+pid_t launchfork(struct launch *l) {
+    pid_t pid;
+
+    // IN NEW PROCESS
+    if ((pid = fork()) == 0) {
+        childsetup(l);
+        // Should never get here, if we do, something went wrong
+        exit(-1);
+    }
+
+    return pid;
+}
+
+
+// posix_spawn(), the background setup is done through spawn attributes and file actions
+pid_t launchspawn(struct launch *l) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t none;
+    pid_t pid;
+
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+
+    // Same as childsetup(), the child starts with no signals blocked
+    sigemptyset(&none);
+    posix_spawnattr_setsigmask(&attr, &none);
+    short flags = POSIX_SPAWN_SETSIGMASK;
+
+    if (l->bg) { flags |= POSIX_SPAWN_SETSID; }
+    posix_spawnattr_setflags(&attr, flags);
+
+    for (int i = STDIN_FILENO; i <= STDERR_FILENO; i++) {
+        if (stdiofd(l, i) != -1) { posix_spawn_file_actions_adddup2(&actions, stdiofd(l, i), i); }
+        else if (l->bg) { posix_spawn_file_actions_addclose(&actions, i); }
+    }
+
+    if (posix_spawn(&pid, l->name, &actions, &attr, l->args, environ) != 0) { pid = -1; }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    // There is no spawn attribute for affinity, pin it once it has started
+    if (pid > 0) { pincpu(pid, l->cpu); }
+
+    return pid;
+}
+
+
+// clone(CLONE_VM | CLONE_VFORK), we are suspended until the child has exec'd
+// The pidfd comes from the clone itself if one is asked for
+pid_t launchvfork(struct launch *l, int *pidfd) {
+    static char *stack = NULL;
+    if (stack == NULL) { stack = (char *)malloc(LAUNCH_STACK); }
+
+    // Stack grows down, start the child at the top of it
+    int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+    if (pidfd != NULL) { flags |= CLONE_PIDFD; }
+    return clone(vforkchild, stack + LAUNCH_STACK, flags, l, pidfd);
+}
+
+
+// Starts the program with the given launcher, returns its pid or -1 if it couldn't be started
+// fds are what it gets as stdin, stdout and stderr (-1 to keep the shell's), NULL for none of them
+// group_fd is the cgroup.procs it is put in, -1 for none
+// pidfd is set to a pidfd for the process, or -1 if it couldn't get one, NULL to not get one
+pid_t launch(int how, char *name, char **args, int bg, int cpu, int *fds, int group_fd, int *pidfd) {
+    struct launch l = { name, args, bg, cpu, fds, group_fd };
+    pid_t pid;
+
+    // Anything still buffered would be printed after the process's own output
+    fflush(stdout);
+    if (pidfd != NULL) { *pidfd = -1; }
+
+    // Nor is there one for groups, and the process has to be in its group before it runs
+    // vfork costs the same as spawn, and its child joins the group itself
+    if (how == LAUNCH_VFORK || (how == LAUNCH_SPAWN && group_fd != -1)) { return launchvfork(&l, pidfd); }
+    pid = (how == LAUNCH_SPAWN) ? launchspawn(&l) : launchfork(&l);
+
+    // It is our child and we haven't reaped it, so the pid is still its own even if it has died
+    if (pid > 0 && pidfd != NULL) { *pidfd = pidfdopen(pid); }
+    return pid;
+}
+
+
+// Launcher with the given name, -1 if there is none
+int launcher(char *name) {
+    for (int i = 0; i < NUM_LAUNCHERS; i++) {
+        if (strcmp(name, launch_names[i]) == 0) { return i; }
+    }
+    return -1;
+}
@@ -0,0 +1,146 @@
+// Load generator for the control socket of the shell
+// Connects a number of clients to a running shell, each sending the same command over and over
+// Every client keeps a window of commands in flight, replies come back in the order they were sent
+// Reports commands per second and how long each took to be answered
+
+// Usage: loadgen [-S socket] [-c clients] [-n commands] [-w window] [command]
+//      socket   - where the shell's control socket is, $HOME/.newshell.sock if not given
+//      clients  - number of connections, 16 if not given
+//      commands - number each client sends, 1000 if not given
+//      window   - most commands a client has in flight, 8 if not given
+//      command  - what is sent, "exec /bin/true(&)" if not given
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Biggest reply read, anything past it is cut off
+#define REPLY_MAX (256 * 1024)
+
+// One connection to the shell
+struct client {
+    int fd;
+    // Commands sent and replies read so far
+    int sent;
+    int received;
+    // When each command in flight was sent, in sec, indexed by its number % window
+    double *sent_at;
+};
+
+
+// Current time in sec
+double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Comparison for qsort, smallest first
+int cmpdouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+int main(int argc, char **argv) {
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    const char *command = "exec /bin/true(&)";
+    int num_clients = 16, commands = 1000, window = 8, i;
+
+    snprintf(path, sizeof(path), "%s/.newshell.sock", getenv("HOME") != NULL ? getenv("HOME") : ".");
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) { snprintf(path, sizeof(path), "%s", argv[++i]); }
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) { num_clients = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) { commands = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) { window = atoi(argv[++i]); }
+        else if (argv[i][0] != '-') { command = argv[i]; }
+        else {
+            printf("Usage: %s [-S socket] [-c clients] [-n commands] [-w window] [command]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (num_clients <= 0 || commands <= 0 || window <= 0) {
+        printf("Clients, commands and window have to be more than 0\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    struct client *clients = (struct client *)malloc(sizeof(struct client) * num_clients);
+    struct pollfd *fds = (struct pollfd *)malloc(sizeof(struct pollfd) * num_clients);
+    double *latency = (double *)malloc(sizeof(double) * num_clients * (long)commands);
+    char *reply = (char *)malloc(REPLY_MAX);
+    long answered = 0, failed = 0;
+    size_t len = strlen(command);
+
+    for (i = 0; i < num_clients; i++) {
+        clients[i].fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (clients[i].fd < 0 || connect(clients[i].fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            printf("Unable to connect to %s\n", path);
+            exit(EXIT_FAILURE);
+        }
+        clients[i].sent = clients[i].received = 0;
+        clients[i].sent_at = (double *)malloc(sizeof(double) * window);
+        fds[i].fd = clients[i].fd;
+    }
+
+    printf("Sending \"%s\" %d times from each of %d clients, %d in flight each\n", command, commands, num_clients, window);
+    double start = seconds();
+    int done = 0;
+
+    while (done < num_clients) {
+        // Send while there is room in the window, then wait for replies
+        for (i = 0; i < num_clients; i++) {
+            struct client *c = &clients[i];
+            while (c->fd != -1 && c->sent < commands && c->sent - c->received < window) {
+                c->sent_at[c->sent % window] = seconds();
+                if (send(c->fd, command, len, MSG_NOSIGNAL) != (ssize_t)len) { break; }
+                c->sent++;
+            }
+            fds[i].events = (c->fd == -1) ? 0 : POLLIN | ((c->sent < commands && c->sent - c->received < window) ? POLLOUT : 0);
+            fds[i].fd = c->fd;
+        }
+
+        if (poll(fds, num_clients, -1) < 0 && errno != EINTR) { break; }
+
+        for (i = 0; i < num_clients; i++) {
+            struct client *c = &clients[i];
+            if (c->fd == -1 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) { continue; }
+
+            ssize_t n;
+            while ((n = recv(c->fd, reply, REPLY_MAX, MSG_DONTWAIT)) > 0) {
+                latency[answered++] = seconds() - c->sent_at[c->received % window];
+                c->received++;
+                if (strncmp(reply, "Invalid", 7) == 0 || strncmp(reply, "Not allowed", 11) == 0) { failed++; }
+            }
+
+            // Hung up on, or every reply is in
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR) || c->received == commands) {
+                if (c->received != commands) { printf("Client %d was dropped after %d replies\n", i, c->received); }
+                close(c->fd);
+                c->fd = -1;
+                done++;
+            }
+        }
+    }
+
+    double elapsed = seconds() - start;
+    qsort(latency, answered, sizeof(double), cmpdouble);
+    printf("\tCOMMANDS\tPER SEC\t\tP50 (ms)\tP99 (ms)\tMAX (ms)\n");
+    printf("\t%ld\t\t%.0f\t\t%.3f\t\t%.3f\t\t%.3f\n", answered, answered / elapsed,
+        (answered != 0) ? latency[answered / 2] * 1000 : 0, (answered != 0) ? latency[answered * 99 / 100] * 1000 : 0,
+        (answered != 0) ? latency[answered - 1] * 1000 : 0);
+    if (failed != 0) { printf("\t%ld commands were refused\n", failed); }
+
+    exit((answered == (long)num_clients * commands) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
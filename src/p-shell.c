@@ -2,17 +2,78 @@
 // In fact we can run literally any executable on the system
 // Here we simply just print the arguments passed to the program
 // For a select amount of time per print
+// It can also do real work in each round instead of sleeping, so the schedulers can be compared on it
+
+// Usage: p-shell n qt [mode] [size]
+//      n    - number of rounds, a message is printed for each
+//      qt   - msec each round takes
+//      mode - what a round does, sleep if not given
+//          sleep - sleeps qt msec, the program uses no CPU at all
+//          cpu   - computes for qt msec of CPU time
+//          mem   - streams over a buffer of size bytes for qt msec of CPU time, MEM_SIZE if not given
+//          io    - writes and reads back blocks of size bytes of a temporary file for qt msec of CPU time, IO_SIZE if not given
+//          mix   - the rounds take turns being cpu, mem, io and sleep
+//      size - buffer or block size for mem and io, a number of bytes that may end in K, M or G
+// Except for sleep, a round is qt msec of CPU time, so a program has the same work to do however many share the CPU
+// and takes longer the more it has to wait for it
+// On exit it prints how much work it got done, and how fast, per second it was alive and per second of CPU it had
 
 // All background and foreground logic handleed in shell.c
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
 
+// Default buffer size of mem, bigger than the caches so it is the memory bus that is measured
+#define MEM_SIZE (64L * 1024 * 1024)
+// Default block size of io
+#define IO_SIZE (4L * 1024)
+// io writes blocks over this much of its file, then starts again at the front
+#define IO_SPAN (1L * 1024 * 1024)
+// Iterations of the compute kernel, and words of the buffer mem streams over, between looks at the clock
+#define CPU_CHUNK 4096
+#define MEM_CHUNK (64 * 1024)
+
+// Modes of a round
+#define MODE_SLEEP 0
+#define MODE_CPU 1
+#define MODE_MEM 2
+#define MODE_IO 3
+#define MODE_MIX 4
+#define NUM_MODES 5
+
+const char *mode_names[NUM_MODES] = { "sleep", "cpu", "mem", "io", "mix" };
+// What the work of each mode is counted in
+const char *work_units[NUM_MODES] = { "rounds", "ops", "bytes", "syscalls", "" };
+// Order the rounds of mix take turns in
+const int mix_modes[4] = { MODE_CPU, MODE_MEM, MODE_IO, MODE_SLEEP };
+
+// Work done by each mode, and the CPU time in msec spent doing it
+double work[NUM_MODES];
+double work_cpu[NUM_MODES];
+
+// Buffer streamed over by mem, and the temporary file and block of io
+uint64_t *mem_buf = NULL;
+long mem_size = MEM_SIZE;
+long mem_pos = 0;
+int io_fd = -1;
+char *io_block = NULL;
+long io_size = IO_SIZE;
+long io_off = 0;
+
+// Result of the compute kernel, kept so the compiler can't throw the loop away
+volatile uint64_t sink;
+
+
 void cont(int sig_num) {
 
 }
@@ -21,18 +82,159 @@ void stop(int sig_num) {
     pause();
 }
 
+
+// Time of a clock in msec
+double msec(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Reads a size like 64M, -1 if it isn't one
+long parsesize(const char *s) {
+    char *end;
+    long n = strtol(s, &end, 10);
+    if (end == s || n <= 0) { return -1; }
+
+    if (*end == 'K' || *end == 'k') { n <<= 10; end++; }
+    else if (*end == 'M' || *end == 'm') { n <<= 20; end++; }
+    else if (*end == 'G' || *end == 'g') { n <<= 30; end++; }
+    return (*end == '\0') ? n : -1;
+}
+
+
+// Computes until the CPU clock reaches until, integer and floating point multiplies that never touch memory
+// Returns the number of iterations
+double runcpu(double until) {
+    uint64_t x = sink | 1;
+    double y = 1.0, ops = 0;
+
+    while (msec(CLOCK_PROCESS_CPUTIME_ID) < until) {
+        for (int i = 0; i < CPU_CHUNK; i++) {
+            // xorshift, and a multiply-add that stays finite
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            y = y * 0.999999 + (double)(x & 0xff);
+        }
+        ops += CPU_CHUNK;
+    }
+    sink = x + (uint64_t)y;
+    return ops;
+}
+
+// Streams over the buffer until the CPU clock reaches until, reading every word and writing it back changed
+// It goes on from where the round before stopped, a chunk at a time
+// Returns the number of bytes read and written
+double runmem(double until) {
+    long words = mem_size / sizeof(uint64_t);
+    double bytes = 0;
+
+    while (msec(CLOCK_PROCESS_CPUTIME_ID) < until) {
+        long end = (mem_pos + MEM_CHUNK < words) ? mem_pos + MEM_CHUNK : words;
+        for (long i = mem_pos; i < end; i++) { mem_buf[i] += i; }
+        bytes += 2.0 * (end - mem_pos) * sizeof(uint64_t);
+        mem_pos = (end == words) ? 0 : end;
+    }
+    return bytes;
+}
+
+// Writes a block to the file and reads it back until the CPU clock reaches until
+// The page cache takes both, so it is the syscalls that cost and not the disk
+// Returns the number of syscalls made
+double runio(double until) {
+    double calls = 0;
+
+    while (msec(CLOCK_PROCESS_CPUTIME_ID) < until) {
+        if (pwrite(io_fd, io_block, io_size, io_off) != io_size || pread(io_fd, io_block, io_size, io_off) != io_size) {
+            printf("Unable to write to the temporary file\n");
+            exit(EXIT_FAILURE);
+        }
+        calls += 2;
+        io_off += io_size;
+        if (io_off + io_size > IO_SPAN) { io_off = 0; }
+    }
+    return calls;
+}
+
+// Does one round of a mode, taking qt msec
+void dowork(int mode, int qt) {
+    double start = msec(CLOCK_PROCESS_CPUTIME_ID), until = start + qt;
+
+    if (mode == MODE_SLEEP) {
+        usleep(1000 * qt);
+        work[mode]++;
+    }
+    else if (mode == MODE_CPU) { work[mode] += runcpu(until); }
+    else if (mode == MODE_MEM) { work[mode] += runmem(until); }
+    else if (mode == MODE_IO) { work[mode] += runio(until); }
+    work_cpu[mode] += msec(CLOCK_PROCESS_CPUTIME_ID) - start;
+}
+
+
 int main(int argc, char **argv) {
-    int i, num, sltime;
+    int i, num, sltime, mode = MODE_SLEEP;
 
     signal(SIGQUIT, cont);
     signal(SIGTSTP, stop);
 
+    if (argc < 3) {
+        printf("Usage: %s n qt [sleep|cpu|mem|io|mix] [size]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
     num = atoi(argv[1]);
-    sltime = 1000 * atoi(argv[2]);
-    
+    sltime = atoi(argv[2]);
+
+    if (argc > 3) {
+        for (mode = 0; mode < NUM_MODES && strcmp(argv[3], mode_names[mode]) != 0; mode++) { }
+        if (mode == NUM_MODES) {
+            printf("Unknown mode %s, it is one of sleep, cpu, mem, io or mix\n", argv[3]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    long size = (argc > 4) ? parsesize(argv[4]) : 0;
+    if (size < 0) {
+        printf("Invalid size %s\n", argv[4]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Set up what the rounds need before the clock starts
+    if (mode == MODE_MEM || mode == MODE_MIX) {
+        if (size != 0) { mem_size = size; }
+        mem_buf = (uint64_t *)malloc(mem_size);
+        if (mem_buf == NULL || mem_size < (long)sizeof(uint64_t)) {
+            printf("Unable to allocate %ld bytes\n", mem_size);
+            exit(EXIT_FAILURE);
+        }
+        // Touched once, so the page faults aren't counted as bandwidth
+        memset(mem_buf, 1, mem_size);
+    }
+    if (mode == MODE_IO || mode == MODE_MIX) {
+        if (size != 0) { io_size = (size < IO_SPAN) ? size : IO_SPAN; }
+        io_fd = open("/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+        io_block = (char *)malloc(io_size);
+        if (io_fd < 0 || io_block == NULL) {
+            printf("Unable to make a temporary file\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(io_block, 'x', io_size);
+    }
+
+    double wall = msec(CLOCK_MONOTONIC), cpu = msec(CLOCK_PROCESS_CPUTIME_ID);
+
     for (i = 1; i <= num; i++){
         printf("This is program %s and it prints for the %d time of %d...\n", argv[0], i, num);
-        usleep(sltime);
+        // Mix goes cpu, mem, io, sleep, cpu ...
+        dowork((mode == MODE_MIX) ? mix_modes[(i - 1) % 4] : mode, sltime);
+    }
+
+    // How much work got done, per second alive and per second on the CPU
+    wall = msec(CLOCK_MONOTONIC) - wall;
+    cpu = msec(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    printf("Program %s did %d %s rounds of %d msec in %.0f msec, %.0f msec of it on the CPU\n", argv[0], num, mode_names[mode], sltime, wall, cpu);
+    for (i = MODE_CPU; i <= MODE_IO; i++) {
+        if (work[i] == 0) { continue; }
+        printf("\t%s: %.4g %s, %.4g per sec, %.4g per CPU sec\n", mode_names[i], work[i], work_units[i], work[i] * 1000 / wall, (work_cpu[i] != 0) ? work[i] * 1000 / work_cpu[i] : 0);
     }
 
     exit(EXIT_SUCCESS);
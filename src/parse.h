@@ -0,0 +1,223 @@
+// Zero-copy input parsing
+// Input is read in big blocks into one buffer, and split into lines and words in place
+// A view points into that buffer instead of copying what it points at
+// Nothing is copied until a process is enqueued, and then only once (see enqueue in queue.h)
+
+// Bytes asked for on each read
+#define READ_BLOCK (64 * 1024)
+// Most args a single program can be given
+#define MAX_ARGS 64
+// Most [key=value,...] attributes a single program can be given
+#define MAX_ATTRS 8
+
+// Part of a string, not null terminated
+struct view {
+    char *s;
+    size_t len;
+};
+
+// Buffered reader of lines from a file descriptor
+struct reader {
+    int fd;
+    char *buf;
+    size_t cap;
+    // Bytes buf[start, end) have been read but not yet returned as lines
+    size_t start;
+    size_t end;
+    // Flag set once the end of the input has been read
+    int closed;
+};
+
+
+// Initialize a reader on a file descriptor
+void initreader(struct reader *r, int fd) {
+    r->fd = fd;
+    r->cap = READ_BLOCK;
+    r->buf = (char *)malloc(r->cap);
+    r->start = 0;
+    r->end = 0;
+    r->closed = 0;
+}
+
+// Reads the next block into the buffer, returns what read() did
+// Lines returned before this are no longer valid, the buffer may move
+ssize_t fill(struct reader *r) {
+    // Move what is left to the front, and grow if a line still doesn't leave room for a block
+    if (r->start != 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    if (r->cap - r->end < READ_BLOCK) {
+        r->cap *= 2;
+        r->buf = (char *)realloc(r->buf, r->cap);
+    }
+
+    ssize_t n = read(r->fd, r->buf + r->end, r->cap - r->end);
+    if (n > 0) { r->end += n; }
+    if (n == 0) { r->closed = 1; }
+    return n;
+}
+
+// Returns 1 and the next complete line (without its newline), or 0 if there isn't one yet
+// Once the input is closed, whatever is left is the last line
+int readline(struct reader *r, struct view *line) {
+    char *s = r->buf + r->start;
+    size_t left = r->end - r->start;
+    if (left == 0) { return 0; }
+
+    char *nl = (char *)memchr(s, '\n', left);
+    if (nl == NULL && !r->closed) { return 0; }
+
+    line->s = s;
+    line->len = (nl != NULL) ? (size_t)(nl - s) : left;
+    r->start += line->len + (nl != NULL);
+    return 1;
+}
+
+// Returns 1 if there is unread input, complete line or not
+int buffered(struct reader *r) {
+    return r->end != r->start;
+}
+
+
+// Takes the next word off the front of a line, returns 0 if there are none left
+int nextword(struct view *line, struct view *word) {
+    while (line->len != 0 && isspace((unsigned char)*line->s)) {
+        line->s++;
+        line->len--;
+    }
+    if (line->len == 0) { return 0; }
+
+    word->s = line->s;
+    while (line->len != 0 && !isspace((unsigned char)*line->s)) {
+        line->s++;
+        line->len--;
+    }
+    word->len = line->s - word->s;
+    return 1;
+}
+
+// Number of words left in a line
+int countwords(struct view line) {
+    struct view word;
+    int n = 0;
+    while (nextword(&line, &word)) { n++; }
+    return n;
+}
+
+// Returns 1 if the view holds exactly the given string
+int vieweq(struct view v, const char *s) {
+    return strlen(s) == v.len && memcmp(v.s, s, v.len) == 0;
+}
+
+// Integer value of the view, like atoi
+int viewint(struct view v) {
+    int sign = 1, n = 0;
+    size_t i = 0;
+    if (v.len != 0 && (v.s[0] == '-' || v.s[0] == '+')) { sign = (v.s[i++] == '-') ? -1 : 1; }
+    for (; i < v.len && isdigit((unsigned char)v.s[i]); i++) { n = n * 10 + (v.s[i] - '0'); }
+    return sign * n;
+}
+
+// Size in bytes of a view like 512, 64K, 100M or 2G, -1 if it isn't one
+long viewsize(struct view v) {
+    long n = 0;
+    size_t i;
+    for (i = 0; i < v.len && isdigit((unsigned char)v.s[i]); i++) { n = n * 10 + (v.s[i] - '0'); }
+    if (i == 0) { return -1; }
+    if (i == v.len) { return n; }
+    if (i + 1 != v.len) { return -1; }
+
+    switch (toupper((unsigned char)v.s[i])) {
+        case 'K': return n << 10;
+        case 'M': return n << 20;
+        case 'G': return n << 30;
+        default: return -1;
+    }
+}
+
+// Time in msec of a view like 500, 500ms, 2s or 5m, -1 if it isn't one
+long viewmsec(struct view v) {
+    long n = 0;
+    size_t i;
+    for (i = 0; i < v.len && isdigit((unsigned char)v.s[i]); i++) { n = n * 10 + (v.s[i] - '0'); }
+    if (i == 0) { return -1; }
+
+    struct view unit = { v.s + i, v.len - i };
+    if (unit.len == 0 || vieweq(unit, "ms")) { return n; }
+    if (vieweq(unit, "s")) { return n * 1000; }
+    if (vieweq(unit, "m")) { return n * 60000; }
+    return -1;
+}
+
+// Takes the next item off the front of a list split on sep, like a+b+c
+// Returns 0 if there are none left, or the item is empty
+int nextitem(struct view *list, char sep, struct view *item) {
+    if (list->len == 0) { return 0; }
+
+    char *end = (char *)memchr(list->s, sep, list->len);
+    item->s = list->s;
+    item->len = (end != NULL) ? (size_t)(end - list->s) : list->len;
+    list->s += item->len + (end != NULL);
+    list->len -= item->len + (end != NULL);
+    return item->len != 0;
+}
+
+
+
+// Splits [k1=v1,k2=v2,...] off the end of a word, into the keys and values of each attribute
+// Returns how many there are, 0 if the word has none and -1 if they aren't in that form
+int parseattrs(struct view *word, struct view *keys, struct view *vals) {
+    if (word->len == 0 || word->s[word->len - 1] != ']') { return 0; }
+
+    char *open = (char *)memrchr(word->s, '[', word->len);
+    if (open == NULL) { return -1; }
+
+    // Split what is in the brackets on commas, then each of them on its =
+    char *s = open + 1, *end = word->s + word->len - 1;
+    int n = 0;
+    while (s < end) {
+        char *comma = (char *)memchr(s, ',', end - s);
+        if (comma == NULL) { comma = end; }
+        char *eq = (char *)memchr(s, '=', comma - s);
+        if (n == MAX_ATTRS || eq == NULL || eq == s || eq + 1 == comma) { return -1; }
+
+        keys[n].s = s;
+        keys[n].len = eq - s;
+        vals[n].s = eq + 1;
+        vals[n].len = comma - eq - 1;
+        n++;
+        s = comma + 1;
+    }
+
+    word->len = open - word->s;
+    return n;
+}
+
+// Parses p(a1,a2,...) into the program name and its args
+// args[0] is the name, returns how many args there are or 0 if it isn't in that form
+//      If it doesn't have a process name it is not valid
+//      If it doesn't have a start or end parenthesis, it is invalid
+int parseprogram(struct view word, struct view *args) {
+    char *paren = (char *)memchr(word.s, '(', word.len);
+    if (paren == NULL || paren == word.s || word.s[word.len - 1] != ')') { return 0; }
+
+    args[0].s = word.s;
+    args[0].len = paren - word.s;
+
+    // Split what is in the parenthesis on commas
+    char *s = paren + 1, *end = word.s + word.len - 1;
+    int argc = 1;
+    while (s < end) {
+        if (argc == MAX_ARGS) { return 0; }
+
+        char *comma = (char *)memchr(s, ',', end - s);
+        if (comma == NULL) { comma = end; }
+        args[argc].s = s;
+        args[argc].len = comma - s;
+        argc++;
+        s = comma + 1;
+    }
+    return argc;
+}
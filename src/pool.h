@@ -0,0 +1,150 @@
+// Memory for queued processes
+// Nodes come from a slab pool, a free list of fixed size objects carved out of big slabs
+// Each process's name and arguments are packed into one block bump allocated from an arena
+// A chunk of the arena is given back once every block in it is freed
+// Submitting a batch costs a malloc per slab or chunk, not several per process
+
+// Objects per slab
+#define SLAB_OBJECTS 256
+// Size of an arena chunk, a block bigger than a quarter of this gets a chunk to itself
+#define ARENA_CHUNK (64 * 1024)
+// Every block starts on this boundary
+#define ARENA_ALIGN 16
+
+// Round n up to a multiple of ARENA_ALIGN
+#define ALIGNED(n) (((n) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+// Pool of fixed size objects
+struct pool {
+    // Size of each object, at least a pointer so free objects can be linked through themselves
+    size_t size;
+    // Free objects, each holds a pointer to the next
+    void *free;
+
+    // Objects handed out and not yet given back
+    long live;
+    long slabs;
+};
+
+// Chunk of the arena, the blocks follow the header
+struct chunk {
+    size_t size;
+    size_t used;
+    // Blocks in the chunk that haven't been freed
+    long live;
+};
+
+// Bump allocator for variable sized blocks
+struct arena {
+    // Chunk new blocks are taken from
+    struct chunk *curr;
+    long chunks;
+};
+
+// Memory held from the system by the pools and arenas, and the most it has ever been
+size_t mem_held = 0;
+size_t mem_high = 0;
+
+
+// Counts memory taken from the system
+void memtake(size_t size) {
+    mem_held += size;
+    if (mem_held > mem_high) { mem_high = mem_held; }
+}
+
+
+// Initialize a pool of objects of the given size
+void initpool(struct pool *p, size_t size) {
+    p->size = (size < sizeof(void *)) ? sizeof(void *) : ALIGNED(size);
+    p->free = NULL;
+    p->live = 0;
+    p->slabs = 0;
+}
+
+// Takes an object from the pool, adding a slab if it is empty
+void *poolalloc(struct pool *p) {
+    if (p->free == NULL) {
+        char *slab = (char *)malloc(p->size * SLAB_OBJECTS);
+        memtake(p->size * SLAB_OBJECTS);
+        p->slabs++;
+
+        // Link every object of the slab onto the free list
+        for (int i = SLAB_OBJECTS - 1; i >= 0; i--) {
+            *(void **)(slab + i * p->size) = p->free;
+            p->free = slab + i * p->size;
+        }
+    }
+
+    void *obj = p->free;
+    p->free = *(void **)obj;
+    p->live++;
+    return obj;
+}
+
+// Gives an object back to the pool, slabs are kept for the next batch
+void poolfree(struct pool *p, void *obj) {
+    *(void **)obj = p->free;
+    p->free = obj;
+    p->live--;
+}
+
+
+// Initialize an empty arena
+void initarena(struct arena *a) {
+    a->curr = NULL;
+    a->chunks = 0;
+}
+
+// Allocates a new chunk big enough for a block of the given size
+struct chunk *newchunk(struct arena *a, size_t size) {
+    size_t chunk_size = ALIGNED(sizeof(struct chunk)) + size;
+    if (chunk_size < ARENA_CHUNK) { chunk_size = ARENA_CHUNK; }
+
+    struct chunk *c = (struct chunk *)malloc(chunk_size);
+    memtake(chunk_size);
+    a->chunks++;
+
+    c->size = chunk_size;
+    c->used = ALIGNED(sizeof(struct chunk));
+    c->live = 0;
+    return c;
+}
+
+// Frees a chunk that has no blocks left in it
+void dropchunk(struct arena *a, struct chunk *c) {
+    mem_held -= c->size;
+    a->chunks--;
+    free(c);
+}
+
+// Bump allocates a block from the arena, chunk is set to the chunk it came from
+void *arenaalloc(struct arena *a, size_t size, struct chunk **chunk) {
+    size = ALIGNED(size);
+
+    // Big blocks get a chunk of their own, so they don't waste the rest of the current one
+    if (size > ARENA_CHUNK / 4) {
+        *chunk = newchunk(a, size);
+    }
+    else {
+        // Start a new chunk if the block doesn't fit, the old one is freed once its blocks are
+        if (a->curr == NULL || a->curr->used + size > a->curr->size) {
+            if (a->curr != NULL && a->curr->live == 0) { dropchunk(a, a->curr); }
+            a->curr = newchunk(a, size);
+        }
+        *chunk = a->curr;
+    }
+
+    void *block = (char *)*chunk + (*chunk)->used;
+    (*chunk)->used += size;
+    (*chunk)->live++;
+    return block;
+}
+
+// Frees a block, and its chunk once every block in it is freed
+void arenafree(struct arena *a, struct chunk *c) {
+    if (--c->live != 0) { return; }
+
+    // The current chunk is reused from the start instead
+    if (c == a->curr) { c->used = ALIGNED(sizeof(struct chunk)); }
+    else { dropchunk(a, c); }
+}
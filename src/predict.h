@@ -0,0 +1,158 @@
+// Burst time prediction for SJF and SRTF
+// Each program (keyed by its path) keeps an exponential average of how long it actually ran
+//      tau = alpha * t + (1 - alpha) * tau
+// t is how long the process held a slot, measured when it is reaped
+// The table is saved to a file on exit and loaded again when the shell starts
+
+#include "hash.h"
+
+// Weight of the latest run against the history
+#define PREDICT_ALPHA 0.5
+// Starting size of the table, doubles when full
+#define PREDICT_INIT 64
+// Guess in msec for a program that has never run and gives us nothing to go on
+#define PREDICT_DEFAULT 100
+// File the table is kept in, relative to $HOME
+#define PREDICT_FILE ".newshell_bursts"
+
+// History of one program
+struct prediction {
+    char *path;
+    // Predicted burst in msec
+    double tau;
+    // Number of runs that went into tau
+    long runs;
+
+    // Next prediction in the same bucket
+    struct prediction *next;
+};
+
+// Table of predictions, chained hash table keyed on the program path
+struct predictor {
+    struct prediction **table;
+    int cap;
+    int count;
+
+    double alpha;
+    // Where the table is saved, NULL if it isn't
+    char *file;
+};
+
+
+// Bucket of the table for a given path
+struct prediction **predictbucket(const char *path, struct predictor *p) {
+    return &p->table[hashstr(path) & (p->cap - 1)];
+}
+
+// Finds the history of a program, NULL if it has never run
+struct prediction *lookup(const char *path, struct predictor *p) {
+    struct prediction *curr = *predictbucket(path, p);
+    while (curr != NULL && strcmp(curr->path, path) != 0) { curr = curr->next; }
+    return curr;
+}
+
+// Double the table and rehash every prediction into it
+void growpredictor(struct predictor *p) {
+    struct prediction **old = p->table;
+    int old_cap = p->cap;
+
+    p->cap *= 2;
+    p->table = (struct prediction **)calloc(p->cap, sizeof(struct prediction *));
+    for (int i = 0; i < old_cap; i++) {
+        struct prediction *curr = old[i];
+        while (curr != NULL) {
+            struct prediction *next = curr->next;
+            struct prediction **b = predictbucket(curr->path, p);
+            curr->next = *b;
+            *b = curr;
+            curr = next;
+        }
+    }
+    free(old);
+}
+
+// Adds a program to the table with the given history
+struct prediction *addprediction(const char *path, double tau, long runs, struct predictor *p) {
+    if (p->count >= p->cap) { growpredictor(p); }
+
+    struct prediction *curr = (struct prediction *)malloc(sizeof(struct prediction));
+    curr->path = strdup(path);
+    curr->tau = tau;
+    curr->runs = runs;
+
+    struct prediction **b = predictbucket(path, p);
+    curr->next = *b;
+    *b = curr;
+    p->count++;
+    return curr;
+}
+
+
+// Predicted burst of a program in msec
+// guess is used for a program that has never run, PREDICT_DEFAULT if it is 0 or less
+int predict(const char *path, int guess, struct predictor *p) {
+    struct prediction *curr = lookup(path, p);
+    if (curr != NULL) { return (int)(curr->tau + 0.5); }
+    return (guess > 0) ? guess : PREDICT_DEFAULT;
+}
+
+// Adds a finished run of a program to its history
+void record(const char *path, int ms, struct predictor *p) {
+    struct prediction *curr = lookup(path, p);
+
+    // The first run is all we know
+    if (curr == NULL) {
+        addprediction(path, ms, 1, p);
+        return;
+    }
+    curr->tau = p->alpha * ms + (1 - p->alpha) * curr->tau;
+    curr->runs++;
+}
+
+
+// Saves the table to its file, one "tau runs path" line per program
+// Written to a temporary file first, so a crash never leaves half a table behind
+void savepredictor(struct predictor *p) {
+    if (p->file == NULL) { return; }
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", p->file);
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) { return; }
+
+    for (int i = 0; i < p->cap; i++) {
+        for (struct prediction *curr = p->table[i]; curr != NULL; curr = curr->next) {
+            fprintf(f, "%.3f %ld %s\n", curr->tau, curr->runs, curr->path);
+        }
+    }
+    fclose(f);
+    rename(tmp, p->file);
+}
+
+// Loads the table from its file, if there is one
+void loadpredictor(struct predictor *p) {
+    if (p->file == NULL) { return; }
+
+    FILE *f = fopen(p->file, "r");
+    if (f == NULL) { return; }
+
+    double tau;
+    long runs;
+    char path[4096];
+    while (fscanf(f, "%lf %ld %4095[^\n]", &tau, &runs, path) == 3) {
+        if (lookup(path, p) == NULL) { addprediction(path, tau, runs, p); }
+    }
+    fclose(f);
+}
+
+
+// Initialize the predictor, loading the history saved in file (NULL to not save one)
+void initpredictor(struct predictor *p, double alpha, const char *file) {
+    p->cap = PREDICT_INIT;
+    p->count = 0;
+    p->table = (struct prediction **)calloc(p->cap, sizeof(struct prediction *));
+
+    p->alpha = alpha;
+    p->file = (file != NULL) ? strdup(file) : NULL;
+    loadpredictor(p);
+}
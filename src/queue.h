@@ -1,10 +1,66 @@
 // Queue to represent scheduling
-// If SJF, queue will be sorted by shortest time
-// If FCFS, queue will be sorted by order of arrival
+// Waiting processes are kept in an array backed binary min-heap
+// If SJF or SRTF, heap will be ordered by shortest (remaining) time
+// If FCFS or RR, heap will be ordered by order of arrival
+// If EDF, heap will be ordered by deadline, jobs without one go after every job that has one, see deadline.h
+// Ties are always broken by order of arrival, so equal jobs stay FIFO
+// RR, SRTF and EDF are preemptive, a preempted process is requeued with what it has left
+// Times are predicted from how long each program ran before, see predict.h
+// MLFQ doesn't use the heap, it keeps a FIFO list per priority level and a bitmap of the non-empty ones
+//      New processes start at the top level, using up a quantum drops a process a level
+//      The quantum doubles with each level, and every MLFQ_BOOST msec everything goes back to the top
+// FAIR doesn't use it either, it keeps a FIFO list per group and picks the group that has had the least for its weight, see share.h
+// A pipeline is one job, its first stage waits in the heap and the rest hang off it
+// With more than one slot, jobs that others wait on go first, see dag.h
+// EDF also keeps the waiting jobs that have a deadline in a treap ordered on it, each node holding the predicted time of its subtree
+//      So the work due by any time, for admission, is found in O(log n) instead of by going over every heap
+// With -q each slot has a run queue of its own, a heap ordered like the one above
+//      New processes go into the shortest one, a preempted process goes back into the one of its slot
+//      A slot takes from its own run queue, and steals from the longest one once its own is empty
+//      MLFQ and FAIR always have one, their levels and groups are shared by every slot
+
+#include <time.h>
+#include <limits.h>
+
+#include "predict.h"
+#include "pool.h"
+#include "parse.h"
 
 #define NO_PID -1
+#define NO_SLOT -1
 #define FCFS 0
 #define SJF 1
+#define RR 2
+#define SRTF 3
+#define MLFQ 4
+#define FAIR 5
+#define EDF 6
+#define NUM_SCHED 7
+
+#include "share.h"
+
+// Quantum in msec for RR when the program doesn't give one
+#define DEFAULT_QUANTUM 100
+
+// Number of MLFQ levels, quantum in msec of the top one and how often in msec all are boosted to it
+#define MLFQ_LEVELS 5
+#define MLFQ_QUANTUM 20
+#define MLFQ_BOOST 1000
+
+// Names of the scheduling types, indexed by type
+const char *sched_names[] = { "FCFS", "SJF", "RR", "SRTF", "MLFQ", "FAIR", "EDF" };
+
+// Returns 1 if name is one of the schedulers
+int isscheduler(const char *name) {
+    for (int i = 0; i < NUM_SCHED; i++) {
+        if (strcmp(name, sched_names[i]) == 0) { return 1; }
+    }
+    return 0;
+}
+
+// Starting sizes of the heap and the pid index, both double when full
+#define HEAP_INIT 64
+#define INDEX_INIT 64
 
 // Node represents a process queue
 struct node {
@@ -16,147 +72,842 @@ struct node {
     // Including args inside of the node makes things easier
     // to keep track of. Especially when switching to queued process
     char **args;
-
-    // Next process in the queue
+    // Arena chunk the name and args are packed in
+    struct chunk *chunk;
+    // Flag set if the last arg is &, the process runs in the background
+    int bg;
+
+    // Estimated exec time, evaluated once when the node is enqueued
+    // Lowered by how long the process ran each time it is preempted
+    int time;
+    // Time in msec the process was last given a slot
+    long started;
+    // Total time in msec the process has held a slot, its actual burst once it is done
+    int ran;
+    // Times in msec the process was enqueued, first started (-1 until then) and finished, for accounting
+    long arrived;
+    long first_started;
+    long finished;
+    // Order of arrival, used to break ties between equal jobs
+    unsigned long seq;
+    // Position of the node in the heap, NO_SLOT if it is not waiting
+    // With MLFQ it is only NO_SLOT or not, the node is in the list of its level instead
+    int slot;
+    // Run queue it waits in, or goes back into once it has run, NO_SLOT if it hasn't been given one
+    int rq;
+    // MLFQ level, 0 is the top, and the nodes before and after it in the list of that level
+    // With FAIR the nodes before and after it in the list of its group
+    int level;
+    struct node *level_prev;
+    struct node *level_next;
+    // Worker slot the process runs in, NO_SLOT if it isn't running
+    int worker;
+
+    // Next stage of the pipeline, the one reading this one's output, NULL if it is the last
+    struct node *pipe;
+    // First stage of the pipeline, the node itself if it isn't piped from anything
+    // Only the leader is in the heap, it holds the slot and is scheduled for the whole pipeline
+    struct node *leader;
+    // Stages of the pipeline still alive, only kept in the leader
+    int live;
+
+    // Limits of the job from [cpu=percent,mem=size], 0 if not given, only kept in the leader
+    int cpu_max;
+    long mem_max;
+    // cgroup the job runs in, 0 if none (see cgroup.h)
+    long group;
+    // Id of the job in the journal, 0 if it isn't in one (see journal.h), only kept in the leader
+    long entry;
+    // pidfd of a process adopted from the shell before a restart, -1 if it is our own child
+    int pidfd;
+    // Flag set once the process has been sent SIGTERM by kill, it is sent SIGKILL if it is killed again
+    int killed;
+    // Flag set if a stage exited with a non-zero status, was killed or couldn't start, only kept in the leader
+    int failed;
+    // Exit code of the first stage that exited with a non-zero one, -1 once a stage is killed by a signal
+    // or ends in a way that isn't known, only kept in the leader
+    int status;
+    // CPU time in msec and max RSS in KB of the stages that have died, added up for the job's accounting
+    // cpu is -1 once a stage ends in a way whose usage isn't known, only kept in the leader
+    double cpu;
+    long maxrss;
+    // Key of the job in the result cache, NULL until it is looked up (see cache.h), only kept in the leader
+    char *key;
+    size_t key_len;
+
+    // Time in msec the job is due by, on the clock arrived is on, 0 if it has no deadline (see deadline.h), only kept in the leader
+    long deadline;
+    // EDF, children in the treap of waiting jobs with deadlines, and the predicted time of the job and all of them
+    struct node *due_left;
+    struct node *due_right;
+    long due_sum;
+    // Group the job gets its fair share with, NULL for the default one (see share.h), only kept in the leader
+    struct share *share;
+    // Place of the job in the graph of jobs waiting on each other, NULL if it isn't in it (see dag.h)
+    struct task *task;
+    // Msec of work in the longest chain of jobs waiting on this one, 0 if none are
+    int tail;
+    // Last /proc sample of the process for top, NULL until it is first taken (see top.h)
+    struct sample *sample;
+
+    // Next node in the same bucket of the pid index
     struct node *next;
 };
 
-// Queue to represent FCFS scheduling
+// Heap of waiting processes, heap[0] is always the next one to run from it
+struct runqueue {
+    struct node **heap;
+    int size;
+    int cap;
+
+    // Processes taken by its own slot, and stolen by other slots
+    long picks;
+    long stolen;
+};
+
+// Queue of processes, waiting ones in the run queues and started ones in the index
 struct queue {
-    struct node *head;
-    struct node *tail;
+    // Run queues, only rq[0] unless each slot has its own
+    struct runqueue *rq;
+    int num_rq;
+    // Processes waiting in all of them, and how many of those have already run, preempted or adopted from the journal
+    int size;
+    int preempted;
+
+    // Processes picked for a free slot and the total and longest time in nsec picking took
+    // and how many processes were stolen from another slot's run queue
+    long picks;
+    long steals;
+    long long pick_ns;
+    long long pick_max;
+
+    // Chained hash table from pid to node, size is always a power of 2
+    // Lets delete() find a process in O(1) instead of walking the queue
+    struct node **index;
+    int index_cap;
+    int count;
+
+    // MLFQ, FIFO list of each level, how many are in it and a bit set for each level that isn't empty
+    struct node *level_head[MLFQ_LEVELS];
+    struct node *level_tail[MLFQ_LEVELS];
+    int level_size[MLFQ_LEVELS];
+    unsigned int level_map;
+
+    // FAIR, the groups and their heap
+    struct shares shares;
+    // EDF, root of the treap of waiting jobs with deadlines, from every run queue
+    struct node *due;
+
+    // Arrival counter handed out to each enqueued node
+    unsigned long seq;
+
+    // History the times are predicted from, NULL to only go by the arguments
+    struct predictor *predictor;
 
     // Type of scheduling to use
     int sched_type;
+    // Flag set if jobs are ordered on their tail first, so the critical path of the graph runs first
+    int critical;
 };
 
 
+// Memory every queue's nodes and args come from, see pool.h
+struct pool node_pool;
+struct arena arg_arena;
+
+
 // Initialize the queue
 void initqueue(struct queue *q, int sched_type) {
-    q->head = NULL;
-    q->tail = NULL;
+    // Shared by all queues, set up by the first one
+    if (node_pool.size == 0) {
+        initpool(&node_pool, sizeof(struct node));
+        initarena(&arg_arena);
+    }
 
+    q->num_rq = 1;
+    q->rq = (struct runqueue *)calloc(1, sizeof(struct runqueue));
+    q->rq[0].cap = HEAP_INIT;
+    q->rq[0].heap = (struct node **)malloc(sizeof(struct node *) * HEAP_INIT);
+    q->size = 0;
+    q->preempted = 0;
+    q->picks = q->steals = 0;
+    q->pick_ns = q->pick_max = 0;
+
+    q->index_cap = INDEX_INIT;
+    q->count = 0;
+    q->index = (struct node **)calloc(q->index_cap, sizeof(struct node *));
+
+    for (int i = 0; i < MLFQ_LEVELS; i++) {
+        q->level_head[i] = q->level_tail[i] = NULL;
+        q->level_size[i] = 0;
+    }
+    q->level_map = 0;
+    initshares(&q->shares);
+
+    q->seq = 0;
+    q->predictor = NULL;
     q->sched_type = sched_type;
+    q->critical = 0;
+    q->due = NULL;
+}
+
+// Returns 1 if waiting processes are kept in the run queue heaps, MLFQ and FAIR keep lists instead
+int usesheap(struct queue *q) {
+    return q->sched_type != MLFQ && q->sched_type != FAIR;
+}
+
+// Gives each of n slots a run queue of its own, done before anything is queued
+// MLFQ and FAIR keep their one
+void splitqueue(struct queue *q, int n) {
+    if (!usesheap(q) || n <= 1) { return; }
+
+    free(q->rq[0].heap);
+    free(q->rq);
+    q->num_rq = n;
+    q->rq = (struct runqueue *)calloc(n, sizeof(struct runqueue));
+    for (int i = 0; i < n; i++) {
+        q->rq[i].cap = HEAP_INIT;
+        q->rq[i].heap = (struct node **)malloc(sizeof(struct node *) * HEAP_INIT);
+    }
 }
 
 // Evaluate exec time of node
-int evaltime(struct node *n) {
-    // Given by arg1 * arg2
-    // Specic to our p-shell.c program, so this will can't be generalized
-    // We would need a comprehensive list of the average times for each program
-    // But beyond the scope of this project
-    return atoi(n->args[1]) * atoi(n->args[2]);
+int evaltime(struct node *n, struct queue *q) {
+    // Until a program has run, all we have is arg1 * arg2
+    // Specic to our p-shell.c program, so it is only a first guess
+    int guess = 0;
+    if (n->args[1] != NULL && n->args[2] != NULL) { guess = atoi(n->args[1]) * atoi(n->args[2]); }
+
+    // Once it has run, go by how long it actually took
+    if (q->predictor == NULL) { return guess; }
+    return predict(n->name, guess, q->predictor);
 }
 
 
 // Free a specific node when deleting or dequeueing it from the queue
 void freenode(struct node *n) {
-    // Free the name
-    free(n->name);
-    // Free all arguments
-    for (int i = 0; n->args[i] != NULL; i++) {
-        free(n->args[i]);
+    // Free the name and all arguments, they are all in one block
+    arenafree(&arg_arena, n->chunk);
+    free(n->key);
+
+    // Finall give the node itself back to the pool
+    poolfree(&node_pool, n);
+}
+
+// Free a node and every stage piped from it
+void freejob(struct node *n) {
+    while (n != NULL) {
+        struct node *next = n->pipe;
+        freenode(n);
+        n = next;
     }
-    // Free the array of arguments (2D array)
-    free(n->args);
+}
+
+
+// EDF, returns 1 if node a comes before node b in the treap, on deadline and then on arrival
+int duebefore(struct node *a, struct node *b) {
+    return a->deadline < b->deadline || (a->deadline == b->deadline && a->seq < b->seq);
+}
 
-    // Finall free the node itself
-    free(n);
+// EDF, priority of a node in the treap, a hash of its arrival so the treap stays balanced whatever order the deadlines come in
+unsigned long dueprio(struct node *n) {
+    return n->seq * 0x9E3779B97F4A7C15UL;
 }
 
-// Standard insert for FCFS scheduling
-void standardinsert(struct node *curr_node, struct queue *q) {
-    // If the queue is empty, set the head and tail to the new node
-    if (q->head == NULL && q->tail == NULL) {
-        q->head = curr_node;
-        q->tail = curr_node;
+// EDF, predicted time of a subtree of the treap
+long duesum(struct node *t) {
+    return (t != NULL) ? t->due_sum : 0;
+}
+
+// EDF, joins two treaps, every node of a comes before every node of b
+struct node *duemerge(struct node *a, struct node *b) {
+    if (a == NULL) { return b; }
+    if (b == NULL) { return a; }
+    if (dueprio(a) > dueprio(b)) {
+        a->due_right = duemerge(a->due_right, b);
+        a->due_sum = duesum(a->due_left) + a->time + duesum(a->due_right);
+        return a;
+    }
+    b->due_left = duemerge(a, b->due_left);
+    b->due_sum = duesum(b->due_left) + b->time + duesum(b->due_right);
+    return b;
+}
+
+// EDF, splits a treap into the nodes that come before n and the rest
+void duesplit(struct node *t, struct node *n, struct node **left, struct node **right) {
+    if (t == NULL) {
+        *left = *right = NULL;
+        return;
+    }
+    if (duebefore(t, n)) {
+        duesplit(t->due_right, n, &t->due_right, right);
+        *left = t;
     }
-    // Add the new node to the end of the queue
     else {
-        // Set the previous tail to point to the new node
-        q->tail->next = curr_node;
-        // Set the tail to the new node
-        q->tail = curr_node;
+        duesplit(t->due_left, n, left, &t->due_left);
+        *right = t;
     }
+    t->due_sum = duesum(t->due_left) + t->time + duesum(t->due_right);
+}
+
+// EDF, takes n out of a treap it is in, returns the new root
+struct node *dueunlink(struct node *t, struct node *n) {
+    if (t == n) { return duemerge(n->due_left, n->due_right); }
+    if (duebefore(n, t)) { t->due_left = dueunlink(t->due_left, n); }
+    else { t->due_right = dueunlink(t->due_right, n); }
+    t->due_sum = duesum(t->due_left) + t->time + duesum(t->due_right);
+    return t;
+}
+
+// Returns 1 if a waiting node is in the treap, only EDF jobs with a deadline are
+int isdue(struct node *n, struct queue *q) {
+    return q->sched_type == EDF && n->deadline != 0 && n->slot != NO_SLOT;
+}
+
+// EDF, adds a waiting node to the treap, its deadline and time can't change until it is taken out again
+void dueinsert(struct node *n, struct queue *q) {
+    if (!isdue(n, q)) { return; }
+
+    struct node *left, *right;
+    duesplit(q->due, n, &left, &right);
+    n->due_left = n->due_right = NULL;
+    n->due_sum = n->time;
+    q->due = duemerge(duemerge(left, n), right);
 }
 
-// Sorted insert for SJF scheduling
-// Sorting on insert ensures queue is always sorted
-// Less efficient than min head - but easier to implement with our current code
-void sortedinsert(struct node *node_to_insert, struct queue *q) {
-    // If queue is empty - speical case
-    if (q->head == NULL && q->tail == NULL) {
-        q->head = node_to_insert;
-        q->tail = node_to_insert;
+// EDF, takes a waiting node out of the treap
+void dueremove(struct node *n, struct queue *q) {
+    if (isdue(n, q)) { q->due = dueunlink(q->due, n); }
+}
+
+// Returns 1 if node a should run before node b
+int before(struct node *a, struct node *b, struct queue *q) {
+    // EDF, the job due first runs first, whatever else waits on the other one
+    if (q->sched_type == EDF && a->deadline != b->deadline) { return b->deadline == 0 || (a->deadline != 0 && a->deadline < b->deadline); }
+    // The longer the chain of jobs waiting on it, the sooner it has to run
+    if (q->critical && a->tail != b->tail) { return a->tail > b->tail; }
+    // SJF/SRTF order on the cached time first, FCFS/RR only on arrival
+    if ((q->sched_type == SJF || q->sched_type == SRTF) && a->time != b->time) { return a->time < b->time; }
+    return a->seq < b->seq;
+}
+
+// Place a node in a heap slot, keeping its slot field up to date
+void setslot(struct node *n, int slot, struct runqueue *r) {
+    r->heap[slot] = n;
+    n->slot = slot;
+}
+
+// Move the node at slot i up until its parent should run before it
+void siftup(int i, struct runqueue *r, struct queue *q) {
+    struct node *n = r->heap[i];
+    while (i > 0 && before(n, r->heap[(i - 1) / 2], q)) {
+        setslot(r->heap[(i - 1) / 2], i, r);
+        i = (i - 1) / 2;
+    }
+    setslot(n, i, r);
+}
+
+// Move the node at slot i down until both children run after it
+void siftdown(int i, struct runqueue *r, struct queue *q) {
+    struct node *n = r->heap[i];
+    int child;
+    while ((child = 2 * i + 1) < r->size) {
+        // Pick the child that should run first
+        if (child + 1 < r->size && before(r->heap[child + 1], r->heap[child], q)) { child++; }
+        if (!before(r->heap[child], n, q)) { break; }
+        setslot(r->heap[child], i, r);
+        i = child;
+    }
+    setslot(n, i, r);
+}
+
+// Moves a waiting node to its place again once it should run sooner or later than it did
+void reorder(struct node *n, struct queue *q) {
+    if (n->slot == NO_SLOT || !usesheap(q)) { return; }
+
+    struct runqueue *r = &q->rq[n->rq];
+    int slot = n->slot;
+    siftup(slot, r, q);
+    if (n->slot == slot) { siftdown(slot, r, q); }
+}
+
+// Run queue a slot takes from first
+int slotqueue(int slot, struct queue *q) {
+    return slot % q->num_rq;
+}
+
+// Shortest run queue, where a new process goes
+int shortestqueue(struct queue *q) {
+    int best = 0;
+    for (int i = 1; i < q->num_rq; i++) {
+        if (q->rq[i].size < q->rq[best].size) { best = i; }
+    }
+    return best;
+}
+
+// Longest run queue, where a slot with nothing left in its own steals from
+int longestqueue(struct queue *q) {
+    int best = 0;
+    for (int i = 1; i < q->num_rq; i++) {
+        if (q->rq[i].size > q->rq[best].size) { best = i; }
+    }
+    return best;
+}
+
+// MLFQ, adds a node to the end of the list of its level
+void levelinsert(struct node *n, struct queue *q) {
+    n->level_next = NULL;
+    n->level_prev = q->level_tail[n->level];
+    if (n->level_prev != NULL) { n->level_prev->level_next = n; }
+    else { q->level_head[n->level] = n; }
+    q->level_tail[n->level] = n;
+
+    q->level_map |= 1u << n->level;
+    q->level_size[n->level]++;
+    n->slot = 0;
+    q->size++;
+}
+
+// MLFQ, takes a node out of the list of its level, wherever it is
+void levelremove(struct node *n, struct queue *q) {
+    if (n->level_prev != NULL) { n->level_prev->level_next = n->level_next; }
+    else { q->level_head[n->level] = n->level_next; }
+    if (n->level_next != NULL) { n->level_next->level_prev = n->level_prev; }
+    else { q->level_tail[n->level] = n->level_prev; }
+
+    if (q->level_head[n->level] == NULL) { q->level_map &= ~(1u << n->level); }
+    q->level_size[n->level]--;
+    n->slot = NO_SLOT;
+    q->size--;
+}
+
+// FAIR, adds a node to the end of the list of its group, the group goes into the heap if nothing of it was waiting
+void shareinsert(struct node *n, struct queue *q) {
+    if (n->share == NULL) { n->share = defaultshare(&q->shares); }
+    struct share *g = n->share;
+    if (!busyshare(g)) { wakeshare(g, &q->shares); }
+
+    n->level_next = NULL;
+    n->level_prev = g->tail;
+    if (n->level_prev != NULL) { n->level_prev->level_next = n; }
+    else { g->head = n; }
+    g->tail = n;
+
+    if (g->waiting++ == 0) { shareheapinsert(g, &q->shares); }
+    n->slot = 0;
+    q->size++;
+}
+
+// FAIR, takes a node out of the list of its group, wherever it is
+void shareremove(struct node *n, struct queue *q) {
+    struct share *g = n->share;
+    if (n->level_prev != NULL) { n->level_prev->level_next = n->level_next; }
+    else { g->head = n->level_next; }
+    if (n->level_next != NULL) { n->level_next->level_prev = n->level_prev; }
+    else { g->tail = n->level_prev; }
+
+    if (--g->waiting == 0) { shareheapremove(g, &q->shares); }
+    if (!busyshare(g)) { idleshare(g, &q->shares); }
+    n->slot = NO_SLOT;
+    q->size--;
+}
+
+// Adds a node to the heap of waiting processes, in its run queue or the shortest one if it has none
+void heapinsert(struct node *n, struct queue *q) {
+    if (n->first_started != -1) { q->preempted++; }
+    if (q->sched_type == MLFQ) {
+        levelinsert(n, q);
+        return;
+    }
+    if (q->sched_type == FAIR) {
+        shareinsert(n, q);
         return;
     }
 
-    // If insert is new head - special case
-    if (evaltime(q->head) > evaltime(node_to_insert)) {
-        node_to_insert->next = q->head;
-        q->head = node_to_insert;
+    if (n->rq == NO_SLOT || n->rq >= q->num_rq) { n->rq = shortestqueue(q); }
+    struct runqueue *r = &q->rq[n->rq];
+
+    // Double the heap if it is full
+    if (r->size == r->cap) {
+        r->cap *= 2;
+        r->heap = (struct node **)realloc(r->heap, sizeof(struct node *) * r->cap);
+    }
+
+    setslot(n, r->size++, r);
+    siftup(n->slot, r, q);
+    q->size++;
+    dueinsert(n, q);
+}
+
+// Takes a node out of the heap, wherever it is
+void heapremove(struct node *n, struct queue *q) {
+    if (n->first_started != -1) { q->preempted--; }
+    if (q->sched_type == MLFQ) {
+        levelremove(n, q);
+        return;
     }
-    // If insert is new tail - special case
-    else if (evaltime(q->tail) <= evaltime(node_to_insert)) {
-        q->tail->next = node_to_insert;
-        q->tail = node_to_insert;
+    if (q->sched_type == FAIR) {
+        shareremove(n, q);
+        return;
     }
-    // Otherwise, insert in the proper sorted order
-    else {
-        // Locate the node before the point of insertion
-        struct node *curr_node = q->head;
-        while (curr_node->next != NULL && evaltime(curr_node->next) < evaltime(node_to_insert)) {
-            curr_node = curr_node->next;
-        }
 
-        // Insert the node
-        node_to_insert->next = curr_node->next;
-        curr_node->next = node_to_insert;
+    dueremove(n, q);
+    struct runqueue *r = &q->rq[n->rq];
+    int slot = n->slot;
+    struct node *last = r->heap[--r->size];
+    n->slot = NO_SLOT;
+    q->size--;
+
+    // Removed the last node, nothing to fix
+    if (last == n) { return; }
+
+    // Fill the hole with the last node and restore the heap in whichever direction it needs
+    setslot(last, slot, r);
+    siftup(slot, r, q);
+    if (last->slot == slot) { siftdown(slot, r, q); }
+}
+
+
+// Bucket in the pid index for a given pid
+struct node **bucket(int pid, struct queue *q) {
+    return &q->index[(unsigned int)pid & (q->index_cap - 1)];
+}
+
+// Double the pid index and rehash every node into it
+void growindex(struct queue *q) {
+    struct node **old = q->index;
+    int old_cap = q->index_cap;
+
+    q->index_cap *= 2;
+    q->index = (struct node **)calloc(q->index_cap, sizeof(struct node *));
+
+    for (int i = 0; i < old_cap; i++) {
+        struct node *curr_node = old[i];
+        while (curr_node != NULL) {
+            struct node *next_node = curr_node->next;
+            struct node **b = bucket(curr_node->pid, q);
+            curr_node->next = *b;
+            *b = curr_node;
+            curr_node = next_node;
+        }
     }
+    free(old);
+}
+
+// Gives a node its pid once the process has started, and indexes it
+void setpid(struct node *n, int pid, struct queue *q) {
+    if (q->count >= q->index_cap) { growindex(q); }
+
+    n->pid = pid;
+    struct node **b = bucket(pid, q);
+    n->next = *b;
+    *b = n;
+    q->count++;
+}
+
+// Finds the node with the given pid, NULL if there is none
+struct node *find(int key, struct queue *q) {
+    struct node *curr_node = *bucket(key, q);
+    while (curr_node != NULL && curr_node->pid != key) { curr_node = curr_node->next; }
+    return curr_node;
+}
+
+// Takes a node out of the pid index
+void unindex(struct node *n, struct queue *q) {
+    struct node **link = bucket(n->pid, q);
+    while (*link != NULL && *link != n) { link = &(*link)->next; }
+    if (*link == NULL) { return; }
+
+    *link = n->next;
+    n->next = NULL;
+    q->count--;
 }
 
 
-// Adds a node to the end of the queue
-void enqueue(char *name, char **args, struct queue *q) {
+// Creates a node for a program, not yet in the queue
+// args[0] is the name of the program, the views are copied so they can go away after
+struct node *newnode(struct view *args, int argc, struct queue *q) {
     // Create a new node, with pid and name as passed arguments
-    struct node *curr_node = (struct node *)malloc(sizeof(struct node));
+    struct node *curr_node = (struct node *)poolalloc(&node_pool);
     // When we enqueue, we do not run the process
     curr_node->pid = NO_PID;
+    curr_node->worker = NO_SLOT;
+    curr_node->slot = NO_SLOT;
+    curr_node->rq = NO_SLOT;
+    curr_node->next = NULL;
+    curr_node->pipe = NULL;
+    curr_node->leader = curr_node;
+    curr_node->live = 0;
+    curr_node->cpu_max = 0;
+    curr_node->mem_max = 0;
+    curr_node->group = 0;
+    curr_node->entry = 0;
+    curr_node->pidfd = -1;
+    curr_node->killed = 0;
+    curr_node->failed = 0;
+    curr_node->status = 0;
+    curr_node->cpu = 0;
+    curr_node->maxrss = 0;
+    curr_node->key = NULL;
+    curr_node->key_len = 0;
+    curr_node->deadline = 0;
+    curr_node->due_left = curr_node->due_right = NULL;
+    curr_node->due_sum = 0;
+    curr_node->share = NULL;
+    curr_node->task = NULL;
+    curr_node->tail = 0;
+    curr_node->sample = NULL;
+    curr_node->level = 0;
+
+    // Size the block for the args array and the args exactly
+    int i;
+    size_t size = sizeof(char *) * (argc + 1);
+    for (i = 0; i < argc; i++) { size += args[i].len + 1; }
+
+    // Pack them into one block, the args array first and then each string with its terminator
+    curr_node->args = (char **)arenaalloc(&arg_arena, size, &curr_node->chunk);
+    char *str = (char *)(curr_node->args + argc + 1);
+    for (i = 0; i < argc; i++) {
+        curr_node->args[i] = memcpy(str, args[i].s, args[i].len);
+        str[args[i].len] = '\0';
+        str += args[i].len + 1;
+    }
+    curr_node->args[argc] = NULL;
+    // The name is the first arg
+    curr_node->name = curr_node->args[0];
+    curr_node->bg = argc > 1 && strcmp(curr_node->args[argc - 1], "&") == 0;
+    // The & only says how to run it, the program itself doesn't get it
+    if (curr_node->bg) { curr_node->args[argc - 1] = NULL; }
+
+    // Evaluate the time once here, instead of on every comparison
+    curr_node->time = evaltime(curr_node, q);
+    curr_node->started = 0;
+    curr_node->ran = 0;
+    curr_node->arrived = 0;
+    curr_node->first_started = -1;
+    curr_node->finished = 0;
+    curr_node->seq = q->seq++;
+    return curr_node;
+}
 
-    // Allocate memory for the name and copy it
-    curr_node->name = (char *)malloc(sizeof(char) * strlen(name));
-    curr_node->name = strcpy(curr_node->name, name);
+// Adds a node to the queue, in its place based on the scheduling type
+struct node *enqueue(struct view *args, int argc, struct queue *q) {
+    struct node *curr_node = newnode(args, argc, q);
+    heapinsert(curr_node, q);
+    return curr_node;
+}
 
-    // Allocate memory for the arguments and copy them
-    // 10 can be any number, it's just a placeholder (should be more than 4)
-    curr_node->args = (char **)malloc(sizeof(char *) * 10);
-    for (int i = 0; args[i] != NULL; i++) {
-        curr_node->args[i] = (char *)malloc(sizeof(char) * strlen(args[i]));
-        curr_node->args[i] = strcpy(curr_node->args[i], args[i]);
+// Adds a program as the next stage of a waiting pipeline, prev is its last stage
+// The stages run at the same time, so the pipeline takes as long as its longest one
+// and runs in the background if its last stage does
+struct node *pipeto(struct node *prev, struct view *args, int argc, struct queue *q) {
+    struct node *curr_node = newnode(args, argc, q);
+    struct node *leader = prev->leader;
+    prev->pipe = curr_node;
+    curr_node->leader = leader;
+
+    for (struct node *stage = leader; stage != NULL; stage = stage->pipe) { stage->bg = curr_node->bg; }
+
+    // Taking longer only moves it further back in the heap, MLFQ doesn't order on time
+    if (curr_node->time > leader->time) {
+        dueremove(leader, q);
+        leader->time = curr_node->time;
+        dueinsert(leader, q);
+        reorder(leader, q);
     }
+    return curr_node;
+}
+
+
+// Next process to run, NULL if nothing is waiting
+// With MLFQ it is the first one in the top level that has any
+// With FAIR it is the first one of the group with the lowest pass
+// With a run queue per slot it is the one that should run first of all their heads
+struct node *peek(struct queue *q) {
+    if (q->size == 0) { return NULL; }
+    if (q->sched_type == MLFQ) { return q->level_head[__builtin_ctz(q->level_map)]; }
+    if (q->sched_type == FAIR) { return q->shares.heap[0]->head; }
 
-    // Determine where to insert the node based on the scheduling type
-    if (q->sched_type == FCFS) { standardinsert(curr_node, q); }
-    else if (q->sched_type == SJF) { sortedinsert(curr_node, q); }
-    else { standardinsert(curr_node, q); }
+    struct node *best = NULL;
+    for (int i = 0; i < q->num_rq; i++) {
+        if (q->rq[i].size != 0 && (best == NULL || before(q->rq[i].heap[0], best, q))) { best = q->rq[i].heap[0]; }
+    }
+    return best;
+}
+
+// Next process for a slot to run, from its own run queue or stolen from the longest one, NULL if nothing is waiting
+struct node *peekfor(int slot, struct queue *q) {
+    if (q->size == 0) { return NULL; }
+    if (!usesheap(q)) { return peek(q); }
+
+    struct runqueue *r = &q->rq[slotqueue(slot, q)];
+    if (r->size == 0) { r = &q->rq[longestqueue(q)]; }
+    return r->heap[0];
+}
+
+// FAIR, a process is taken out to run, its group is charged for it
+void dispatch(struct node *n, struct queue *q) {
+    if (q->sched_type == FAIR) { startshare(n->share, &q->shares); }
+}
+
+// FAIR, a process that was taken out to run left its slot after ran msec, its group is charged what it ran
+// Called when it is preempted, after it is requeued, or when it dies in its slot
+void charge(struct node *n, long ran, struct queue *q) {
+    if (q->sched_type == FAIR) { settleshare(n->share, ran, &q->shares); }
+}
+
+// Takes a waiting process out to run in a slot, it goes back into the run queue of that slot if it is preempted
+// Counted as stolen if it waited in the run queue of another slot
+void take(struct node *n, int slot, struct queue *q) {
+    int own = slotqueue(slot, q);
+    dispatch(n, q);
+    if (usesheap(q)) {
+        if (n->rq == own) { q->rq[own].picks++; }
+        else {
+            q->rq[n->rq].stolen++;
+            q->steals++;
+        }
+    }
+
+    heapremove(n, q);
+    n->rq = own;
+}
+
+// Time in nsec, for how long picking takes
+long long picktime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Removes the next process for a slot to run and returns it, NULL if nothing is waiting
+// The node is not freed, it is still in the queue once it is given a pid
+struct node *popfor(int slot, struct queue *q) {
+    long long start = picktime();
+    struct node *curr_node = peekfor(slot, q);
+    if (curr_node == NULL) { return NULL; }
+    take(curr_node, slot, q);
+
+    q->picks++;
+    long long took = picktime() - start;
+    q->pick_ns += took;
+    if (took > q->pick_max) { q->pick_max = took; }
+    return curr_node;
+}
+
+// Removes the next process to run from the heap and returns it
+// The node is not freed, it is still in the queue once it is given a pid
+struct node *pop(struct queue *q) {
+    struct node *curr_node = peek(q);
+    if (curr_node == NULL) { return NULL; }
+    dispatch(curr_node, q);
+    heapremove(curr_node, q);
+    return curr_node;
+}
+
+// Puts a preempted process back in the heap, behind everything already waiting
+// It keeps its pid, so it stays in the index too
+void requeue(struct node *n, struct queue *q) {
+    n->seq = q->seq++;
+    heapinsert(n, q);
+}
+
+// Time quantum of a process in msec, 0 if it is never preempted on time
+// For RR it is the qt argument of the program, p(n,qt)
+// For MLFQ it is the quantum of its level, for FAIR it is FAIR_QUANTUM so the groups take turns
+int timeslice(struct node *n, struct queue *q) {
+    if (q->sched_type == MLFQ) { return MLFQ_QUANTUM << n->level; }
+    if (q->sched_type == FAIR) { return FAIR_QUANTUM; }
+    if (q->sched_type != RR) { return 0; }
+
+    int qt = (n->args[1] != NULL && n->args[2] != NULL) ? atoi(n->args[2]) : 0;
+    return (qt > 0) ? qt : DEFAULT_QUANTUM;
+}
+
+// MLFQ, drops a process that used up its quantum a level, unless it is already at the bottom
+// Done before it is requeued, so it goes to the end of its new level
+void demote(struct node *n, struct queue *q) {
+    if (q->sched_type == MLFQ && n->level < MLFQ_LEVELS - 1) { n->level++; }
+}
+
+// MLFQ, moves every waiting process back to the top level, in the order of their levels
+// Keeps a long process from waiting forever behind a stream of short ones
+void boost(struct queue *q) {
+    if (q->sched_type != MLFQ) { return; }
+
+    for (int i = 1; i < MLFQ_LEVELS; i++) {
+        if (q->level_head[i] == NULL) { continue; }
+        for (struct node *n = q->level_head[i]; n != NULL; n = n->level_next) { n->level = 0; }
+
+        // Splice the whole list onto the end of the top one
+        q->level_head[i]->level_prev = q->level_tail[0];
+        if (q->level_tail[0] != NULL) { q->level_tail[0]->level_next = q->level_head[i]; }
+        else { q->level_head[0] = q->level_head[i]; }
+        q->level_tail[0] = q->level_tail[i];
+        q->level_head[i] = q->level_tail[i] = NULL;
+        q->level_size[0] += q->level_size[i];
+        q->level_size[i] = 0;
+    }
+    if (q->level_map != 0) { q->level_map = 1; }
+}
+
+// How far back in line a running process is, the one ranked highest is the first to be preempted
+// SRTF ranks on the time it has left after running for ran msec, MLFQ on its level, EDF on its deadline
+long rank(struct node *running, int ran, struct queue *q) {
+    if (q->sched_type == MLFQ) { return running->level; }
+    if (q->sched_type == EDF) { return (running->deadline != 0) ? running->deadline : LONG_MAX; }
+    return running->time - ran;
+}
+
+// Returns 1 if a waiting process should take the place of a running one with the given rank
+int preempts(struct node *waiting, long running_rank, struct queue *q) {
+    if (q->sched_type == MLFQ) { return waiting->level < running_rank; }
+    if (q->sched_type == EDF) { return waiting->deadline != 0 && waiting->deadline < running_rank; }
+    return q->sched_type == SRTF && waiting->time < running_rank;
+}
+
+// EDF, msec of predicted work waiting in the run queues that is due no later than deadline, all of it runs before a job due then
+// Those are a prefix of the treap, added up from the sums on one path down it
+long demand(long deadline, struct queue *q) {
+    long work = 0;
+    for (struct node *t = q->due; t != NULL; ) {
+        if (t->deadline <= deadline) {
+            work += duesum(t->due_left) + t->time;
+            t = t->due_right;
+        }
+        else { t = t->due_left; }
+    }
+    return work;
+}
+
+// EDF, gives a node a deadline, moving it to its place if it is already waiting
+void setdeadline(struct node *n, long deadline, struct queue *q) {
+    dueremove(n, q);
+    n->deadline = deadline;
+    dueinsert(n, q);
+    reorder(n, q);
+}
+
+// Returns 1 if nothing is waiting or running
+int isempty(struct queue *q) {
+    return q->size == 0 && q->count == 0;
 }
 
 
 // Removes the head of the queue and returns its pid
 int dequeue(struct queue *q) {
     // If the queue is empty, let caller know
-    if (q->head == NULL || q->tail == NULL) { return -1; }
+    // It is dropped, not run, so it isn't taken out like pop() does
+    struct node *curr_node = peek(q);
+    if (curr_node == NULL) { return -1; }
+    heapremove(curr_node, q);
 
     // Otherwise, remove the head of the queue and return its pid
-    struct node *curr_node = q->head;
     int curr_pid = curr_node->pid;
-    q->head = q->head->next;
-
-    // If the queue is now empty, set the tail to NULL
-    if (q->head == NULL) { q->tail = NULL; }
+    if (curr_pid != NO_PID) { unindex(curr_node, q); }
 
-    // Free the memory allocated for the removed node
-    freenode(curr_node);
+    // Free the memory allocated for the removed node, and any stages piped from it
+    freejob(curr_node);
 
     return curr_pid;
 }
@@ -164,26 +915,16 @@ int dequeue(struct queue *q) {
 
 // Deletes the node with the given pid from the queue
 void delete(int key, struct queue *q) {
-    struct node *curr_node = q->head;
-    struct node *prev_node = NULL;
-
-    // Search for the node with the given pid, deleting it if found
-    while (curr_node != NULL && curr_node->pid != key) {
-        prev_node = curr_node;
-        curr_node = curr_node->next;
-    }
+    // Look the node up in the index rather than walking the queue
+    struct node *curr_node = find(key, q);
 
     // If the node was not found, return
     if (curr_node == NULL) { return; }
 
-    // If the node is the head of the queue, set the head to the next node
-    if (curr_node == q->head) { q->head = q->head->next; }
-    // If the node is the tail of the queue, set the tail to the previous node
-    if (curr_node == q->tail) { q->tail = prev_node; }
-
-    // Set the previous node to point to the next node
-    if (prev_node != NULL) { prev_node->next = curr_node->next; }
+    // Take it out of wherever it is
+    unindex(curr_node, q);
+    if (curr_node->slot != NO_SLOT) { heapremove(curr_node, q); }
 
     // Free the memory allocated for the removed node
     freenode(curr_node);
-}
\ No newline at end of file
+}
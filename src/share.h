@@ -0,0 +1,248 @@
+// Weighted fair share between groups of jobs, for the FAIR scheduler (stride scheduling)
+// A job can be put in a group with a weight, p(n,qt)[group=build,weight=3], jobs that aren't are in DEFAULT_SHARE
+// Each group has a pass, its virtual time, that goes up by STRIDE1 / weight for every msec its jobs hold a slot
+// The group with the lowest pass runs next, so over time each one gets slots in proportion to its weight
+//      A group is charged a quantum up front when one of its jobs gets a slot, so free slots don't all go to it at once
+//      What the job actually ran is settled once it leaves the slot
+//      A group that had nothing to run comes back at the pass of the last group picked, it can't save up for later
+// Groups with jobs waiting are kept in a heap on their pass, picking the next job is O(log groups)
+// Within a group jobs run in the order they came, a preempted one goes to the back (see shareinsert() in queue.h)
+
+#include "hash.h"
+
+// Pass a group with weight 1 goes up by for every msec it runs
+#define STRIDE1 (1 << 20)
+// Starting size of the table of groups, doubles when full
+#define SHARE_INIT 16
+// Group of the jobs that aren't given one, and the weight of a group until it is given one
+#define DEFAULT_SHARE "default"
+#define SHARE_WEIGHT 1
+// Msec a job runs before a job of another group can take its slot
+#define FAIR_QUANTUM 100
+
+// One group of jobs
+struct share {
+    char *name;
+    int weight;
+    // Virtual time, msec run * STRIDE1 / weight
+    long long pass;
+
+    // Jobs waiting, first and last, and how many, and how many are running
+    struct node *head;
+    struct node *tail;
+    int waiting;
+    int running;
+    // Position in the heap, NO_SLOT if nothing of it is waiting
+    int slot;
+
+    // Msec its jobs have held a slot, and the msec it was entitled to by its weight, up to since
+    long consumed;
+    double entitled;
+    // Virtual time of the shell when it last got jobs, it is entitled to weight * (vtime - since) more while it has any
+    double since;
+
+    // Next group in the same bucket
+    struct share *next;
+};
+
+// Every group, chained hash table keyed on the name, and the heap of the ones with jobs waiting
+struct shares {
+    struct share **table;
+    int cap;
+    int count;
+
+    struct share **heap;
+    int size;
+    int heap_cap;
+
+    // Pass of the last group picked, a group that comes back starts from it
+    long long pass;
+    // Msec of slot time per unit of weight every group with jobs has been entitled to so far
+    double vtime;
+    // Total weight of the groups with jobs waiting or running
+    long active_weight;
+    // Group of the jobs that aren't given one
+    struct share *fallback;
+};
+
+
+// Initialize an empty set of groups
+void initshares(struct shares *s) {
+    s->cap = SHARE_INIT;
+    s->count = 0;
+    s->table = (struct share **)calloc(s->cap, sizeof(struct share *));
+    s->heap_cap = SHARE_INIT;
+    s->size = 0;
+    s->heap = (struct share **)malloc(sizeof(struct share *) * s->heap_cap);
+    s->pass = 0;
+    s->vtime = 0;
+    s->active_weight = 0;
+    s->fallback = NULL;
+}
+
+// Bucket of the table for a given name
+struct share **sharebucket(const char *name, size_t len, struct shares *s) {
+    return &s->table[hashbytes(name, len) & (s->cap - 1)];
+}
+
+// Double the table and rehash every group into it
+void growshares(struct shares *s) {
+    struct share **old = s->table;
+    int old_cap = s->cap;
+
+    s->cap *= 2;
+    s->table = (struct share **)calloc(s->cap, sizeof(struct share *));
+    for (int i = 0; i < old_cap; i++) {
+        struct share *curr = old[i];
+        while (curr != NULL) {
+            struct share *next = curr->next;
+            struct share **b = sharebucket(curr->name, strlen(curr->name), s);
+            curr->next = *b;
+            *b = curr;
+            curr = next;
+        }
+    }
+    free(old);
+}
+
+// Finds the group with the given name, making it if there is none
+struct share *getshare(struct view name, struct shares *s) {
+    struct share *curr = *sharebucket(name.s, name.len, s);
+    while (curr != NULL && !vieweq(name, curr->name)) { curr = curr->next; }
+    if (curr != NULL) { return curr; }
+
+    if (s->count >= s->cap) { growshares(s); }
+    curr = (struct share *)calloc(1, sizeof(struct share));
+    curr->name = strndup(name.s, name.len);
+    curr->weight = SHARE_WEIGHT;
+    curr->slot = NO_SLOT;
+    struct share **b = sharebucket(name.s, name.len, s);
+    curr->next = *b;
+    *b = curr;
+    s->count++;
+    return curr;
+}
+
+// Group of the jobs that aren't given one
+struct share *defaultshare(struct shares *s) {
+    if (s->fallback == NULL) {
+        struct view name = { DEFAULT_SHARE, strlen(DEFAULT_SHARE) };
+        s->fallback = getshare(name, s);
+    }
+    return s->fallback;
+}
+
+// Returns 1 if a group has jobs waiting or running
+int busyshare(struct share *g) {
+    return g->waiting + g->running != 0;
+}
+
+// Msec a group has been entitled to so far
+double entitlement(struct share *g, struct shares *s) {
+    return g->entitled + (busyshare(g) ? g->weight * (s->vtime - g->since) : 0);
+}
+
+
+// Place a group in a heap slot, keeping its slot field up to date
+void setshare(struct share *g, int slot, struct shares *s) {
+    s->heap[slot] = g;
+    g->slot = slot;
+}
+
+// Move the group at slot i up until its parent has a lower pass
+void sharesiftup(int i, struct shares *s) {
+    struct share *g = s->heap[i];
+    while (i > 0 && g->pass < s->heap[(i - 1) / 2]->pass) {
+        setshare(s->heap[(i - 1) / 2], i, s);
+        i = (i - 1) / 2;
+    }
+    setshare(g, i, s);
+}
+
+// Move the group at slot i down until both children have a higher pass
+void sharesiftdown(int i, struct shares *s) {
+    struct share *g = s->heap[i];
+    int child;
+    while ((child = 2 * i + 1) < s->size) {
+        if (child + 1 < s->size && s->heap[child + 1]->pass < s->heap[child]->pass) { child++; }
+        if (s->heap[child]->pass >= g->pass) { break; }
+        setshare(s->heap[child], i, s);
+        i = child;
+    }
+    setshare(g, i, s);
+}
+
+// Moves a group to its place again once its pass has changed, if it is in the heap
+void repass(struct share *g, struct shares *s) {
+    if (g->slot == NO_SLOT) { return; }
+    int slot = g->slot;
+    sharesiftup(slot, s);
+    if (g->slot == slot) { sharesiftdown(slot, s); }
+}
+
+// Adds a group to the heap once it has a job waiting
+void shareheapinsert(struct share *g, struct shares *s) {
+    if (s->size == s->heap_cap) {
+        s->heap_cap *= 2;
+        s->heap = (struct share **)realloc(s->heap, sizeof(struct share *) * s->heap_cap);
+    }
+    setshare(g, s->size++, s);
+    sharesiftup(g->slot, s);
+}
+
+// Takes a group out of the heap once it has nothing waiting
+void shareheapremove(struct share *g, struct shares *s) {
+    int slot = g->slot;
+    struct share *last = s->heap[--s->size];
+    g->slot = NO_SLOT;
+    if (last == g) { return; }
+
+    setshare(last, slot, s);
+    sharesiftup(slot, s);
+    if (last->slot == slot) { sharesiftdown(slot, s); }
+}
+
+
+// A group that had no jobs gets one, it starts being entitled to its weight
+// and comes back no earlier than the last group picked
+void wakeshare(struct share *g, struct shares *s) {
+    g->since = s->vtime;
+    s->active_weight += g->weight;
+    if (g->pass < s->pass) { g->pass = s->pass; }
+}
+
+// A group has no jobs left, what it was entitled to while it had them is kept
+void idleshare(struct share *g, struct shares *s) {
+    g->entitled += g->weight * (s->vtime - g->since);
+    s->active_weight -= g->weight;
+}
+
+// Gives a group a new weight, what it was entitled to under the old one is kept
+void setweight(struct share *g, int weight, struct shares *s) {
+    if (weight == g->weight) { return; }
+    if (busyshare(g)) {
+        g->entitled += g->weight * (s->vtime - g->since);
+        g->since = s->vtime;
+        s->active_weight += weight - g->weight;
+    }
+    g->weight = weight;
+}
+
+// A job of a group gets a slot, the group is charged a quantum for it up front
+void startshare(struct share *g, struct shares *s) {
+    s->pass = g->pass;
+    g->running++;
+    g->pass += (long long)FAIR_QUANTUM * (STRIDE1 / g->weight);
+    repass(g, s);
+}
+
+// A job of a group left its slot after ran msec, the group is charged what it actually ran
+// Every group with jobs was entitled to its weight's part of those msec
+void settleshare(struct share *g, long ran, struct shares *s) {
+    if (s->active_weight > 0) { s->vtime += (double)ran / s->active_weight; }
+    g->consumed += ran;
+    g->pass += (long long)(ran - FAIR_QUANTUM) * (STRIDE1 / g->weight);
+    g->running--;
+    repass(g, s);
+    if (!busyshare(g)) { idleshare(g, s); }
+}
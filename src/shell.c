@@ -1,13 +1,23 @@
-// Project 2: Shell with FCFS and Non-preemptive SJF
+// Project 2: Shell with FCFS, Non-preemptive SJF, RR, SRTF, MLFQ, FAIR and EDF
+// Everything happens in one epoll loop over a signalfd, stdin and the scheduler timer
+// The queue is journaled, a shell that restarts picks up the jobs the last one left behind
+// Other programs can submit jobs and ask about them through a control socket, see control.h
 
-// A simple FCFS/Non-Preemptive SJF shell that supports the following commands:
+// A simple FCFS/Non-Preemptive SJF/RR/SRTF/MLFQ/FAIR/EDF shell, running up to N processes at once
+// Supports the following commands:
 //      ver     - prints the shell version
-//      exec    - executes a program with the given parameters
+//      exec    - executes a program with the given parameters, or a pipeline of them
 //      ps      - prints the living processes
+//      top     - prints what the running processes are doing, sorted on a column
+//      shares  - prints the slot time each group of jobs has used against what it is entitled to, with FAIR
+//      trace   - records what the scheduler does, and dumps it for Perfetto
+//      stats   - prints waiting/turnaround times of finished jobs
+//      logs    - prints the output of a background job
 //      kill    - kills a process with the given pid
 //      help    - prints the help page
 //      exit    - exits the shell
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <signal.h>
@@ -16,66 +26,302 @@
 #include <string.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
 #include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <poll.h>
 #include "queue.h"
-
-#define NO_CURR_PID 0
+#include "launch.h"
+#include "stats.h"
+#include "deadline.h"
+#include "capture.h"
+#include "cache.h"
+#include "cgroup.h"
+#include "dag.h"
+#include "journal.h"
+#include "control.h"
+#include "top.h"
+#include "trace.h"
+// How often the preemptive schedulers check the running processes, in msec
+#define TICK_MS 10
+// Most events handled per epoll_wait
+#define MAX_EVENTS 16
+// Msec a process killed on exit has to die before it gets SIGKILL
+#define KILL_GRACE 2000
 
 // Flag to indicate the scheduling type
 // Default is SJF
 int sched_type = SJF;
 
-// PID of the current process running
-pid_t curr_proc_pid = NO_CURR_PID;
-// Current node we are working on
-struct node *curr_proc_node = NULL;
-
-// Flag to indicate if the shell is waiting for input/output
-// Ensures we don't accept input while a process is running
-// 0 = not waiting, 1 = waiting 
+// Worker slot, each one runs at most 1 process at a time
+struct slot {
+    // Node of the process running in the slot, NULL if the slot is free
+    struct node *node;
+    // CPU the slot is pinned to, NO_CPU if it isn't pinned
+    int cpu;
+};
+
+// Worker slots, how many processes can run at once (-j N)
+// Default is the number of online CPUs
+struct slot *slots;
+int num_slots = 0;
+// Number of slots currently running a process
+int num_running = 0;
+// Flag to pin each slot to its own CPU (-p)
+int pin_slots = 0;
+// Flag to give each slot its own run queue (-q), slots are pinned with it so a job stays on its CPU
+int slot_queues = 0;
+
+// How processes are started (-l fork|spawn|vfork)
+// Default is posix_spawn, it doesn't get slower as the queue grows
+int launcher_type = LAUNCH_SPAWN;
+
+// Number of foreground processes started and not yet dead (running or preempted)
+// Ensures we don't accept input while a foreground process is running
+// 0 = not waiting, anything else = waiting 
 int io_occupied = 0;
 
 // Flag to indicate if the shell is suspended
 int fg_suspended = 0;
+// Flag set once the shell is woken up, until the running processes are done
+int waking = 0;
 
 // Flag to indicate if the shell should continue running
 int run = 1;
 
-// Queue of processes (FCFS scheduling)
+// Queue of processes (FCFS, SJF, RR, SRTF, MLFQ or FAIR scheduling)
 struct queue pid_list;
 
+// History of how long each program has run, used to predict SJF/SRTF times
+struct predictor bursts;
+
+// Waiting and turnaround times of finished jobs, for each scheduler
+struct stats sched_stats[NUM_SCHED];
+
+// Output of the background jobs
+struct captures logs;
+
+// Deadlines of the jobs, rejecting the ones that can't make it (-R) and giving them SCHED_DEADLINE (-D)
+struct deadlines deadlines;
+int reject_late = 0;
+int kernel_deadlines = 0;
+
+// Results of background jobs already run, and the directory they are kept in (-C DIR), no cache if not given
+struct cache cache;
+char *cache_dir = NULL;
+
+// Groups the jobs run in, and the pressure new jobs are held back by
+struct cgroups groups;
+struct pressure psi;
+double psi_limit = PSI_LIMIT;
+
+// Time in msec the MLFQ levels were last boosted
+long last_boost = 0;
+
+// Jobs waiting on other jobs, and the jobs they wait on
+struct dag graph;
+
+// Journal of the queue, and the file it is kept in (-J FILE), $HOME/JOURNAL_FILE if not given
+struct journal journal;
+char *journal_file = NULL;
+
+// Control socket, and the file it is bound to (-S FILE), $HOME/CONTROL_FILE if not given
+struct control control;
+// What the scheduler did, while trace is on
+struct tracer tracer;
+char *control_file = NULL;
+// Flag set when a client has changed the queue, it is scheduled once every client waiting has been served
+int requested = 0;
+
+// Flag set if the kernel has pidfds, then every process is signalled and reaped through its own
+// Otherwise they are found by pid when SIGCHLD says something died
+int use_pidfds = 0;
+// Processes with a pidfd, indexed by it, the pidfd is readable once the process has died
+struct node **watched = NULL;
+int watched_cap = 0;
+
+// File descriptors of the event loop
+// signal_fd gets SIGTSTP, SIGQUIT and SIGCHLD if there are no pidfds, timer_fd ticks for RR, SRTF, MLFQ and FAIR
+// sample_fd ticks every TOP_INTERVAL msec to sample the running processes for top
+int epoll_fd;
+int signal_fd;
+int timer_fd = -1;
+int sample_fd = -1;
+
+// Column top sorts on, one of top_columns
+int top_column = 0;
+const char *top_columns[] = { "cpu", "rss", "time", "state", "pid", "slot", "name", NULL };
+
+// Something the shell reads lines from, stdin or a batch file
+struct source {
+    struct reader r;
+    // Flag set when we are waiting on it in the epoll
+    int watching;
+    // Flag set if it is a regular file, those can't go in an epoll but are always ready to read
+    int is_file;
+};
+
+// Commands read from stdin that haven't been run yet
+// Once it is closed, the shell exits when the queue is empty
+struct source input;
+// Flag set when the prompt has been printed for the next command
+int prompted = 0;
+
+// Jobs read from a batch file (batch <file> or --batch), fd is -1 when there is none
+// Only as many are read as there are slots to run them, so a batch is never all in memory
+struct source batch;
+// Line of the batch we are on, for error messages, and how many lines were invalid
+long batch_line = 0;
+long batch_invalid = 0;
+// Jobs done and failed, and cache hits and misses, before the batch started, to tell the batch's own apart
+long batch_done_base = 0;
+long batch_failed_base = 0;
+long batch_hits_base = 0;
+long batch_misses_base = 0;
+
+// Flag cleared by --batch, there is no one to take commands or answer questions
+// The shell exits once the batch is done, with a failure status if any job failed or line was invalid
+int interactive = 1;
+
+// Jobs that have finished, and how many of them failed (non-zero status, killed, couldn't start or cancelled)
+long jobs_done = 0;
+long jobs_failed = 0;
+
+
+// Current time in msec, used to measure how long processes wait and run
+long now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+// Sets up a source to read from fd
+void opensource(struct source *src, int fd) {
+    struct stat st;
+
+    initreader(&src->r, fd);
+    src->watching = 0;
+    src->is_file = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// Reads the next block of a source, it is closed if that fails
+// A pipe that has nothing to read right now is not closed
+void readmore(struct source *src) {
+    if (fill(&src->r) < 0 && errno != EAGAIN) { src->r.closed = 1; }
+}
+
+
+// Asks the user a yes or no question, returns 'y' or 'n'
+// If stdin closes before we get an answer, it is a no
+// If no one is there to answer (--batch), it is a yes
+char ask(char *question) {
+    char answer = '\0';
+    struct view line, word;
+
+    if (!interactive) { return 'y'; }
+
+    do {
+        printf("%s", question);
+        fflush(stdout);
+
+        // Wait for the answer, the line that asked has already been parsed
+        while (!readline(&input.r, &line)) {
+            if (input.r.closed) { return 'n'; }
+            readmore(&input);
+        }
+        if (nextword(&line, &word)) { answer = tolower(word.s[0]); }
+    } while (answer != 'y' && answer != 'n');
+
+    return answer;
+}
+
 
 // Prints the help page and supported commands
 void help() {
     printf("Manual Page\n\n");
     printf("This shell supports the following commands:\n");
-    printf("\tver\n\texec\n\tps\n\tkill\n\thelp\n\texit\n");
+    printf("\tver\n\texec\n\tbatch\n\tps\n\ttop\n\tshares\n\tstats\n\tlogs\n\ttrace\n\tkill\n\thelp\n\texit\n");
     printf("For more details please type 'help <command>'\n");
+    printf("Other programs can send exec, ps, top, shares, kill, stats, logs, trace, ver and help to the control socket (-S FILE)\n");
 }
 
 
 // Prints the help page for a specific command
-void helpcmd(char *cmd) {
+void helpcmd(struct view cmd) {
     printf("Manual Page\n\n");
 
-    if (strcmp(cmd , "ver") == 0) {
+    if (vieweq(cmd, "ver")) {
         printf("ver:\tShows details about the shell version\n");
     }
-    else if (strcmp(cmd, "exec") == 0) {
+    else if (vieweq(cmd, "exec")) {
         // Exec can execute any exectuable not just this one - but we will only use this one
         printf("exec p1(n1,qt1) p2(n2,qt2) ...:\nExecutes the programs p1, p2 ...\nEach program types a message for n times and it is given a time quantum of qt msec.\n");
-        printf("If parameter (&) is given the program will be executed in the background\n");
+        printf("If parameter (&) is given the program will be executed in the background, and its output kept for logs\n");
+        printf("p-shell(n,qt,mode,size) does n rounds of qt msec of cpu, mem, io or mix work instead of sleeping, and prints its work rate\n");
+        printf("p1(...) | p2(...) pipes the output of p1 into p2, they run together as one job in one slot\n");
+        printf("A pipeline runs in the background if its last program does\n");
+        printf("p(n,qt)[cpu=50,mem=64M] runs it in its own cgroup with at most half a CPU and 64 MB of memory\n");
+        printf("p(n,qt)[id=a] names it a, q(n,qt)[after=a+b] only runs once a and b have exited successfully\n");
+        printf("If a or b fails, q is cancelled along with everything after it. With more than one slot,\n");
+        printf("the programs with the longest chain of work after them run first\n");
+        printf("New programs wait while /proc/pressure shows the machine is stalled (-P percent, 0 to turn off)\n");
+        printf("With -C dir a background job run before with the same executables and args is answered from dir without running\n");
+        printf("SJF and SRTF predict each program's time from how long it took before (n*qt until it has run)\n");
+        printf("With RR a program is stopped once it has run for qt msec, and requeued\n");
+        printf("With SRTF a program is stopped when one with less time remaining is waiting\n");
+        printf("With MLFQ a program starts at the top level, and drops a level each time it uses up its quantum\n");
+        printf("Higher levels run first, every %d msec all programs go back to the top\n", MLFQ_BOOST);
+        printf("With FAIR p(n,qt)[group=g,weight=w] runs in group g, and each group gets slots in proportion to its weight\n");
+        printf("A program is stopped after %d msec if one of a group that has had less for its weight is waiting\n", FAIR_QUANTUM);
+        printf("With EDF p(n,qt)[deadline=500ms] is due 500 msec after it is given, 2s or 1m work too, and @SECS is a Unix time\n");
+        printf("The program due first runs first, and takes the slot of the one due last if that is due after it\n");
+        printf("A program predicted to miss its deadline is flagged, or rejected with -R. stats shows how many missed and by how much\n");
+        printf("With -q each slot takes programs from its own queue, and steals from the longest one when it is empty\n");
+    }
+    else if (vieweq(cmd, "batch")) {
+        printf("batch file:\tRuns the jobs in file, one p(n,qt) per line, as slots free up\n");
+        printf("Lines starting with # are skipped. Start the shell with --batch [file] to run one without a prompt\n");
     }
-    else if (strcmp(cmd, "ps") == 0) {
+    else if (vieweq(cmd, "ps")) {
         printf("ps:\tShows the living process with the given pid\n");
     }
-    else if (strcmp(cmd, "kill") == 0) {
+    else if (vieweq(cmd, "top")) {
+        printf("top [column]:\tShows the state, CPU%%, resident memory and CPU time of each running process, sampled every %d msec\n", TOP_INTERVAL);
+        printf("Sorted on cpu if no column is given, or on rss, time, state, pid, slot or name\n");
+        printf("Also shows how many jobs are waiting, preempted and held, and with MLFQ how many are on each level\n");
+    }
+    else if (vieweq(cmd, "shares")) {
+        printf("shares:\tShows the weight of each group of jobs, its waiting and running jobs, and the msec of slot time it has used\n");
+        printf("against the msec its weight entitled it to while it had jobs\n");
+    }
+    else if (vieweq(cmd, "stats")) {
+        printf("stats:\tShows mean/p50/p99 waiting and turnaround times, throughput, CPU time and max RSS of finished jobs\n");
+    }
+    else if (vieweq(cmd, "logs")) {
+        printf("logs pid:\tShows the output of the background job with the given pid, the last %d bytes of it\n", LOG_MAX);
+        printf("A job answered from the cache has no pid, its output is under the negative id it was given\n");
+        printf("Once the logs of finished jobs pass %d MB in all, the oldest ones are removed\n", LOG_TOTAL / (1024 * 1024));
+    }
+    else if (vieweq(cmd, "trace")) {
+        printf("trace start|stop|dump file:\tRecords every job enqueued, dispatched, preempted, exited, reaped or killed, and every stop and continue\n");
+        printf("The last %d events are kept in memory, dump writes them to file as Chrome trace JSON to open in Perfetto\n", TRACE_EVENTS);
+    }
+    else if (vieweq(cmd, "kill")) {
         printf("kill pid:\tEnds the process with the given pid\n");
+        printf("\t\tIt is sent SIGTERM and reaped once it dies, killing it again sends SIGKILL\n");
     }
-    else if (strcmp(cmd, "help") == 0) {
+    else if (vieweq(cmd, "help")) {
         printf("help:\tYou should know this command by now\n");
     }
-    else if (strcmp(cmd, "exit") == 0) {
+    else if (vieweq(cmd, "exit")) {
         printf("exit:\tEnds the experience of working in the new shell\n");
     }
     else {
@@ -86,38 +332,499 @@ void helpcmd(char *cmd) {
 
 // Prints the shell version
 void ver() {
-    // Make a string to determine if we are using FCFS or SJF
-    char *sched_type_str;
-    if (sched_type == SJF) { sched_type_str = "SJF"; }
-    else { sched_type_str = "FCFS"; }
-
     printf("New Shell\n");
     printf("Details:\n");
-    printf("\tScheduler: %s\n", sched_type_str);
-    printf("\tProcessing limit: 1\n");
+    printf("\tScheduler: %s\n", sched_names[sched_type]);
+    printf("\tProcessing limit: %d\n", num_slots);
+    printf("\tLauncher: %s\n", launch_names[launcher_type]);
+    printf("\tBurst history: %d programs\n", bursts.count);
+    printf("\tQueue memory: %ld live nodes, %zu bytes held (high water %zu bytes)\n", node_pool.live, mem_held, mem_high);
+    if (logs.count != 0 || logs.evicted != 0) {
+        printf("\tOutput logs: %d kept in %s, %ld KB of %d KB, %ld of the oldest removed\n", logs.count, logs.dir, logs.bytes / 1024, LOG_TOTAL / 1024, logs.evicted);
+    }
+    if (groups.root[0] == '\0') { printf("\tResource control: off, %s\n", groups.off); }
+    else { printf("\tResource control: a cgroup per job in %s%s%s\n", groups.root, groups.cpu ? ", cpu limits" : "", groups.memory ? ", memory limits" : ""); }
+    if (pid_list.num_rq > 1) { printf("\tRun queues: one per slot, %ld picks in %.0f nsec each on average (max %lld), %ld stolen\n", pid_list.picks, (pid_list.picks != 0) ? (double)pid_list.pick_ns / pid_list.picks : 0.0, pid_list.pick_max, pid_list.steals); }
+    else { printf("\tRun queues: one shared, %ld picks in %.0f nsec each on average (max %lld)\n", pid_list.picks, (pid_list.picks != 0) ? (double)pid_list.pick_ns / pid_list.picks : 0.0, pid_list.pick_max); }
+    if (psi.limit <= 0) { printf("\tAdmission: off\n"); }
+    else { printf("\tAdmission: new jobs held while CPU or memory stall is over %.0f%% (held %ld times)\n", psi.limit, psi.held); }
+    printf("\tDeadlines: jobs that can't make theirs are %s under EDF, ", deadlines.reject ? "rejected" : "flagged");
+    if (deadlines.off != NULL) { printf("SCHED_DEADLINE off, %s\n", deadlines.off); }
+    else { printf("SCHED_DEADLINE on, %ld processes given it, %ld turned down by the kernel\n", deadlines.mapped, deadlines.refused); }
+    if (cache.dir[0] == '\0') { printf("\tResult cache: off, %s\n", cache.off); }
+    else { printf("\tResult cache: %s, %d executables hashed, %ld hits, %ld misses, %ld results stored\n", cache.dir, cache.count, cache.hits, cache.misses, cache.stored); }
+    if (journal.fd == -1) { printf("\tJournal: off, %s\n", journal.off); }
+    else { printf("\tJournal: %s, %zu bytes live of %zu\n", journal.path, journal.live, (size_t)journal.head->used); }
+    if (!tracer.on) { printf("\tTracing: off%s\n", (tracer.ring != NULL) ? ", the last trace can still be dumped" : ""); }
+    else { printf("\tTracing: %lu events of %d kept (%lu written over)\n", traced(&tracer), TRACE_EVENTS, dropped(&tracer)); }
+    if (control.fd == -1) { printf("\tControl socket: off, %s\n", control.off); }
+    else { printf("\tControl socket: %s, %d clients, %ld commands served (%ld clients dropped)\n", control.path, control.count, control.requests, control.dropped); }
 }
 
 
 // Prints the LIVING processes, not the ones that are queued
-// Meaning the current processes (SHELL and the only 1 running)
-// Should never be more than 2 in current implementation
+// Meaning the shell and whatever is running in each slot
 void ps() {
     printf("NEW SHELL presents the following living processes:\n");
-    printf("\tPID\tNAME\n");
+    printf("\tSLOT\tCPU\tPID\tNAME\n");
 
     // Include the process we are in, the shell itself
     // We don't have this on queue because we don't want to kill the shell
     // When doing dequeue it would pop right off the queue
-    printf("\t%d\tNEW SHELL\n", getpid());
+    printf("\t-\t-\t%d\tNEW SHELL\n", getpid());
+
+    // One line per slot, idle or not
+    for (int i = 0; i < num_slots; i++) {
+        printf("\t%d\t", i);
+        if (slots[i].cpu == NO_CPU) { printf("-\t"); }
+        else { printf("%d\t", slots[i].cpu); }
+
+        if (slots[i].node == NULL) {
+            printf("-\tidle\n");
+            continue;
+        }
+
+        // A pipeline goes by the pid of its first stage
+        printf("%d\t%s", slots[i].node->pid, slots[i].node->name);
+        for (struct node *stage = slots[i].node->pipe; stage != NULL; stage = stage->pipe) { printf(" | %s", stage->name); }
+        printf("\n");
+    }
+    printf("\t%d waiting in queue (%d of them preempted)\n", pid_list.size, pid_list.preempted);
+    if (cache.hits != 0) { printf("\t%ld jobs answered from the cache without running\n", cache.hits); }
+    if (graph.held != 0) { printf("\t%ld held until the jobs they come after are done\n", graph.held); }
+    if (saturated(&psi, now())) { printf("\tNew jobs are held, CPU stall %.1f%%, memory stall %.1f%%\n", psi.cpu, psi.memory); }
+}
+
+
+// Samples every stage of every job in a slot, unless it has been sampled already and only missing ones are wanted
+// Jobs that are waiting or preempted aren't read, so the cost only grows with the number of slots
+void sampleslots(int missing) {
+    long time = now();
+
+    for (int i = 0; i < num_slots; i++) {
+        for (struct node *stage = slots[i].node; stage != NULL; stage = stage->pipe) {
+            if (stage->pid == NO_PID || stage->finished != 0) { continue; }
+            if (stage->sample == NULL) { stage->sample = opensample(stage->pid); }
+            else if (missing) { continue; }
+            if (stage->sample != NULL) { takesample(stage->sample, time, stage->first_started); }
+        }
+    }
+}
+
+// Orders two processes for top on top_column, the busiest first for numbers and smallest first otherwise
+int cmptop(const void *a, const void *b) {
+    struct node *x = *(struct node **)a, *y = *(struct node **)b;
+    struct sample *s = x->sample, *t = y->sample;
+
+    switch (top_column) {
+        case 0: return (t->cpu > s->cpu) - (t->cpu < s->cpu);
+        case 1: return (t->rss > s->rss) - (t->rss < s->rss);
+        case 2: return (t->ticks > s->ticks) - (t->ticks < s->ticks);
+        case 3: return s->state - t->state;
+        case 4: return x->pid - y->pid;
+        case 5: return x->worker - y->worker;
+        default: return strcmp(x->name, y->name);
+    }
+}
+
+// Prints what the running processes are doing, sorted on the given column
+void mytop(struct view column) {
+    int i, n = 0;
+
+    top_column = -1;
+    for (i = 0; top_columns[i] != NULL; i++) {
+        if (column.len == 0 || vieweq(column, top_columns[i])) {
+            top_column = i;
+            break;
+        }
+    }
+    if (top_column == -1) {
+        printf("No such column. Type 'help top' for the columns\n");
+        return;
+    }
+
+    // Processes that just started haven't been sampled yet
+    sampleslots(1);
+    struct node **rows = (struct node **)malloc(sizeof(struct node *) * (num_running + 1));
+    int rows_cap = num_running + 1;
+    for (i = 0; i < num_slots; i++) {
+        for (struct node *stage = slots[i].node; stage != NULL; stage = stage->pipe) {
+            if (stage->sample == NULL || stage->finished != 0) { continue; }
+            if (n == rows_cap) {
+                rows_cap *= 2;
+                rows = (struct node **)realloc(rows, sizeof(struct node *) * rows_cap);
+            }
+            rows[n++] = stage;
+        }
+    }
+    qsort(rows, n, sizeof(struct node *), cmptop);
+
+    printf("NEW SHELL top, sampled every %d msec, sorted on %s\n", TOP_INTERVAL, top_columns[top_column]);
+    printf("\tPID\tSLOT\tS\tCPU%%\tRSS KB\tCPU SEC\tNAME\n");
+    for (i = 0; i < n; i++) {
+        struct sample *s = rows[i]->sample;
+        printf("\t%d\t%d\t%c\t%.1f\t%ld\t%.2f\t%s\n", rows[i]->pid, rows[i]->worker, s->state, s->cpu, s->rss, cputime(s), rows[i]->name);
+    }
+    free(rows);
+
+    // Depth of the queue, counted as it changes rather than by walking it
+    printf("\t%d running, %d waiting in queue (%d of them preempted), %ld held\n", num_running, pid_list.size, pid_list.preempted, graph.held);
+    if (sched_type == MLFQ) {
+        printf("\tWaiting on each MLFQ level:");
+        for (i = 0; i < MLFQ_LEVELS; i++) { printf(" %d: %d", i, pid_list.level_size[i]); }
+        printf("\n");
+    }
+    if (pid_list.num_rq > 1) {
+        printf("\tWaiting in each slot's run queue:");
+        for (i = 0; i < pid_list.num_rq; i++) { printf(" %d: %d", i, pid_list.rq[i].size); }
+        printf("\n");
+    }
+}
+
+
+// Comparison for qsort, groups by name
+int cmpshare(const void *a, const void *b) {
+    return strcmp((*(struct share **)a)->name, (*(struct share **)b)->name);
+}
+
+// Prints each group's weight, the slot time its jobs have used and the slot time its weight entitled it to
+// A group is only entitled to slot time while it has jobs waiting or running
+void myshares() {
+    struct shares *s = &pid_list.shares;
+    if (sched_type != FAIR) {
+        printf("Shares are only kept with the FAIR scheduler\n");
+        return;
+    }
+    if (s->count == 0) {
+        printf("No jobs have been queued yet\n");
+        return;
+    }
+
+    struct share **rows = (struct share **)malloc(sizeof(struct share *) * s->count);
+    int i, n = 0;
+    for (i = 0; i < s->cap; i++) {
+        for (struct share *g = s->table[i]; g != NULL; g = g->next) { rows[n++] = g; }
+    }
+    qsort(rows, n, sizeof(struct share *), cmpshare);
+
+    printf("NEW SHELL shares, a job runs %d msec before another group can have its slot\n", FAIR_QUANTUM);
+    printf("\tGROUP\tWEIGHT\tWAITING\tRUNNING\tUSED MS\tENTITLED MS\tUSED/ENTITLED\n");
+    for (i = 0; i < n; i++) {
+        double entitled = entitlement(rows[i], s);
+        printf("\t%s\t%d\t%d\t%d\t%ld\t%.0f\t\t%.2f\n", rows[i]->name, rows[i]->weight, rows[i]->waiting, rows[i]->running,
+            rows[i]->consumed, entitled, (entitled > 0) ? rows[i]->consumed / entitled : 0.0);
+    }
+    free(rows);
+}
+
+
+// Starts or stops recording what the scheduler does, or writes what was recorded to a file
+void mytrace(struct view how, struct view file) {
+    if (vieweq(how, "start") && file.len == 0) {
+        starttrace(&tracer);
+        printf("Tracing the last %d scheduler events\n", TRACE_EVENTS);
+    }
+    else if (vieweq(how, "stop") && file.len == 0) {
+        tracer.on = 0;
+        printf("Tracing stopped, %lu events kept\n", traced(&tracer));
+    }
+    else if (vieweq(how, "dump") && file.len != 0) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%.*s", (int)file.len, file.s);
+        if (tracer.ring == NULL) {
+            printf("Nothing has been traced, start it with trace start\n");
+            return;
+        }
+
+        FILE *f = fopen(path, "we");
+        if (f == NULL) {
+            printf("Unable to open %s\n", path);
+            return;
+        }
+        dumptrace(f, num_slots, &tracer);
+        if (fclose(f) != 0) { printf("Unable to write %s\n", path); }
+        else { printf("Wrote %lu events to %s (%lu older ones were written over)\n", traced(&tracer), path, dropped(&tracer)); }
+    }
+    else { printf("Usage: trace start|stop|dump file\n"); }
+}
+
+
+// Returns 1 if a stage of a job has been started and hasn't died yet
+int alive(struct node *stage) {
+    return stage->pid != NO_PID && stage->finished == 0;
+}
+
+// EDF, tests if a job can finish by its deadline after the work due no later than it, waiting or running, spread over the slots
+// One that can't is flagged, or rejected with -R if it can be
+// Returns 0 if it is rejected, the job is then the caller's to drop
+int meetsdeadline(struct node *job, int can_reject) {
+    if (sched_type != EDF || job->deadline == 0) { return 1; }
+
+    long time = now(), work = demand(job->deadline, &pid_list);
+    for (int i = 0; i < num_slots; i++) {
+        struct node *running = slots[i].node;
+        if (running == NULL || running->deadline == 0 || running->deadline > job->deadline) { continue; }
+        long left = running->time - (time - running->started);
+        if (left > 0) { work += left; }
+    }
+
+    long late = time + work / num_slots + job->time - job->deadline;
+    if (late <= 0) { return 1; }
+    if (can_reject && deadlines.reject) {
+        deadlines.rejected++;
+        printf("Rejected %s, it would miss its deadline by %ld msec\n", job->name, late);
+        return 0;
+    }
+    deadlines.flagged++;
+    printf("Flagged %s, it is predicted to miss its deadline by %ld msec\n", job->name, late);
+    return 1;
+}
+
+// A held job no longer waits on anything, it goes into the heap like any other
+// It is too late to reject it for its deadline, the jobs after it are already waiting on it
+void releasejob(struct node *job) {
+    meetsdeadline(job, 0);
+    heapinsert(job, &pid_list);
+    trace(TRACE_ENQUEUE, job->pid, job->name, NO_SLOT, pid_list.size, &tracer);
+}
+
+// Drops a held job that can never run, a job it comes after failed
+void canceljob(struct node *job) {
+    printf("Cancelled %s, a job it comes after failed\n", job->name);
+    jobs_done++;
+    jobs_failed++;
+    journalfinish(&journal, job->entry);
+    freejob(job);
+}
 
-    struct node *curr_node = pid_list.head;
-    while (curr_node != NULL) {
-        // Only print processes that are "alive", i.e. have a pid
-        if (curr_node->pid != NO_PID) {
-           printf("\t%d\t%s\n", curr_node->pid, curr_node->name);
+// Lets the jobs waiting on a job go once it is done, or cancels them if it failed
+void finishjob(struct node *leader, int ok) {
+    if (leader->task != NULL) { finishtask(leader->task, ok, &graph, releasejob, canceljob); }
+}
+
+// Drops a job that was rejected for its deadline, and any job that would have come after it
+void rejectjob(struct node *job) {
+    jobs_done++;
+    jobs_failed++;
+    journalfinish(&journal, job->entry);
+    finishjob(job, 0);
+    freejob(job);
+}
+
+// Finishes a background job from the result the cache has for it, without starting it
+// Its output is kept as the log of an id of its own, it never had a pid
+// Returns 0 if the cache has no result for it, and it has to run
+int fromcache(struct node *job) {
+    if (cache.dir[0] == '\0' || !job->bg) { return 0; }
+    if (job->key == NULL && (job->key_len = jobkey(job, &job->key, &cache)) == 0) { return 0; }
+
+    size_t size;
+    struct result *res = findresult(job->key, job->key_len, &size, &cache);
+    if (res == NULL) { return 0; }
+
+    int id = cache.next_id--;
+    if (!keepoutput(id, resultoutput(res), res->out_len, &logs)) { id = 0; }
+    printf("Answered %s from the cache, it exited with status %d", job->name, res->status);
+    if (id != 0) { printf(", logs %d has its output", id); }
+    printf("\n");
+
+    cache.hits++;
+    cache.saved += res->ran;
+    jobs_done++;
+    if (res->status != 0) {
+        jobs_failed++;
+        job->failed = 1;
+    }
+    munmap(res, size);
+
+    journalfinish(&journal, job->entry);
+    finishjob(job, !job->failed);
+    freejob(job);
+    return 1;
+}
+
+// Keeps the result of a finished background job in the cache
+// Only if every stage exited on its own, and the whole of its output is in its log
+void keepresult(struct node *leader) {
+    if (leader->key == NULL || leader->status < 0 || (leader->failed && leader->status == 0)) { return; }
+
+    // Get whatever is still sitting in the pipe, it is still open if a stage left something running with it
+    struct capture *cap = findcapture(leader->pid, &logs);
+    if (cap == NULL) { return; }
+    drain(cap, &logs);
+    if (cap->fd != -1 || cap->written > LOG_MAX) { return; }
+
+    char path[LOG_PATH];
+    logpath(leader->pid, &logs, path, sizeof(path));
+    int log = open(path, O_RDONLY | O_CLOEXEC);
+    if (log < 0) { return; }
+    storeresult(leader->key, leader->key_len, leader->status, leader->ran, log, cap->written, &cache);
+    close(log);
+}
+
+// Removes a started process from the queue, freeing its slot if it has one
+// A pipeline only leaves the queue once its last stage has died
+void retire(struct node *dead_node) {
+    if (dead_node == NULL) { return; }
+
+    // It can't be found by its pid anymore, the pid may be reused
+    struct node *leader = dead_node->leader;
+    unindex(dead_node, &pid_list);
+    closesample(dead_node->sample);
+    dead_node->sample = NULL;
+    if (--leader->live != 0) { return; }
+
+    // The whole job is done, counted once however many stages it had
+    jobs_done++;
+    if (leader->failed) { jobs_failed++; }
+    // Account for it under the scheduler it ran with, it held the slot until this last stage died
+    // One we don't know the usage of would skew it
+    if (leader->cpu >= 0) {
+        addsample(&sched_stats[pid_list.sched_type], leader->arrived, leader->first_started, dead_node->finished, dead_node->ran, leader->cpu, leader->maxrss);
+    }
+
+    // If it was in the foreground, the shell is no longer waiting on it
+    if (leader->worker != NO_SLOT) {
+        trace(TRACE_EXIT, leader->pid, leader->name, leader->worker, now() - leader->started, &tracer);
+        slots[leader->worker].node = NULL;
+        num_running--;
+        charge(leader, now() - leader->started, &pid_list);
+    }
+    if (!leader->bg) { io_occupied--; }
+    removegroup(leader->group, &groups);
+    // Met or missed its deadline, under the scheduler it ran with
+    if (leader->deadline != 0) { adddeadline(&sched_stats[pid_list.sched_type], now() - leader->deadline); }
+
+    // Remove the job from the queue, it may still be waiting if it was preempted
+    // Not using dequeue because if we call kill, it will remove the process inproperly
+    if (leader->slot != NO_SLOT) { heapremove(leader, &pid_list); }
+    keepresult(leader);
+    journalfinish(&journal, leader->entry);
+    finishjob(leader, !leader->failed);
+    freejob(leader);
+}
+
+
+// Handles a child that has died, usage is what wait4 said it used
+// status is STATUS_UNKNOWN for one adopted from the journal, it isn't our child so there is no status or usage
+void childexited(int dead_pid, int status, struct rusage *usage) {
+    int known = status != STATUS_UNKNOWN;
+    // Formatting
+    if (known) { printf("The child %d is dead\n", dead_pid); }
+    else { printf("The child %d is dead, it wasn't started by this shell so how it ended is unknown\n", dead_pid); }
+
+    // One that was killed failed, even if it caught the SIGTERM and exited fine
+    struct node *dead_node = find(dead_pid, &pid_list);
+    int failed = (known && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) || (dead_node != NULL && dead_node->killed);
+
+    // Print out and error message if the process exited with a non-zero status
+    // Helps debugging if process fails (for user not for shell)
+    int exit_status = known ? WEXITSTATUS(status) : 0;
+    if (exit_status != 0) {
+        printf("An error occured in the executing process\n");
+        printf("Code: Process %d exited with status %d\n", dead_pid, exit_status);
+    }
+
+    trace(TRACE_REAP, dead_pid, (dead_node != NULL) ? dead_node->name : NULL, (dead_node != NULL) ? dead_node->worker : NO_SLOT, status, &tracer);
+    if (dead_node != NULL) {
+        // A pipeline fails if any of its stages does
+        if (failed) { dead_node->leader->failed = 1; }
+        if (!known || !WIFEXITED(status)) { dead_node->leader->status = -1; }
+        else if (exit_status != 0 && dead_node->leader->status == 0) { dead_node->leader->status = exit_status; }
+        dead_node->finished = now();
+        if (dead_node->worker != NO_SLOT) { dead_node->ran += dead_node->finished - dead_node->started; }
+
+        // Learn how long the program takes, unless it was killed part of the way through or we can't tell
+        if (known && WIFEXITED(status) && !dead_node->killed) { record(dead_node->name, dead_node->ran, &bursts); }
+
+        // What it used goes into the job's, the stages of a pipeline run at once so their memory adds up too
+        struct node *leader = dead_node->leader;
+        if (!known) { leader->cpu = -1; }
+        else if (leader->cpu >= 0) {
+            leader->cpu += (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000.0 + (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1000.0;
+            leader->maxrss += usage->ru_maxrss;
         }
-        curr_node = curr_node->next;
     }
+    
+    // Free up the slot the process was running in
+    retire(dead_node);
+}
+
+
+// Watches the pidfd of a process in the epoll, to know when it dies
+void watchprocess(struct node *stage, int pidfd) {
+    if (pidfd >= watched_cap) {
+        int old_cap = watched_cap;
+        watched_cap = (pidfd + 1) * 2;
+        watched = (struct node **)realloc(watched, sizeof(struct node *) * watched_cap);
+        memset(watched + old_cap, 0, sizeof(struct node *) * (watched_cap - old_cap));
+    }
+    watched[pidfd] = stage;
+    stage->pidfd = pidfd;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = pidfd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfd, &ev);
+}
+
+// Returns 1 if fd is the pidfd of a process
+int iswatched(int fd) {
+    return fd >= 0 && fd < watched_cap && watched[fd] != NULL;
+}
+
+// Sends a signal to a started process, through its pidfd if it has one
+int signalprocess(struct node *stage, int sig) {
+    return (stage->pidfd != -1) ? pidfdsignal(stage->pidfd, sig) : kill(stage->pid, sig);
+}
+
+// Reaps a process whose pidfd says it has died, returns 0 if it turns out it hasn't yet
+// One adopted from the journal isn't our child, so there is no status or usage to get once it has
+int reap(struct node *stage) {
+    struct rusage usage;
+    int pid = stage->pid, fd = stage->pidfd, status;
+
+    memset(&usage, 0, sizeof(usage));
+    int reaped = pidfdreap(fd, &status, &usage);
+    if (reaped == 0 || (reaped == -1 && !pidfddead(fd))) { return 0; }
+    if (reaped == -1) { status = STATUS_UNKNOWN; }
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    watched[fd] = NULL;
+    close(fd);
+    stage->pidfd = -1;
+
+    childexited(pid, status, &usage);
+    return 1;
+}
+
+
+// Prints the waiting and turnaround times of finished jobs for each scheduler
+void mystats() {
+    int shown = 0;
+
+    for (int i = 0; i < NUM_SCHED; i++) {
+        if (sched_stats[i].count == 0) { continue; }
+        printstats(sched_names[i], &sched_stats[i]);
+        shown++;
+    }
+    // Cached jobs never waited or ran, they are counted apart
+    if (cache.hits != 0 || cache.misses != 0 || cache.stored != 0) {
+        printf("Cache: %ld jobs answered from it, %ld missed it and ran, %ld msec of running saved, %ld results stored\n", cache.hits, cache.misses, cache.saved, cache.stored);
+        shown++;
+    }
+    // Rejected jobs never ran, they are counted apart too
+    if (deadlines.flagged != 0 || deadlines.rejected != 0) {
+        printf("Admission: %ld jobs flagged and %ld rejected as predicted to miss their deadline\n", deadlines.flagged, deadlines.rejected);
+        shown++;
+    }
+    if (shown == 0) { printf("No jobs have finished yet\n"); }
+}
+
+
+// Prints the output of the background job with the given pid
+void mylogs(int pid) {
+    if (!printlog(pid, &logs)) { printf("No output was kept for %d\n", pid); }
 }
 
 
@@ -125,11 +832,7 @@ void ps() {
 void mykill(int pid) {
     // If we are killing the shell, ask the user if they are sure
     if (getpid() == pid) {
-        char answer;
-        do {
-            printf("You are about to kill the shell, are you sure? (y/n): ");
-            scanf(" %c", &answer);
-        } while (answer != 'y' && answer != 'n');
+        char answer = ask("You are about to kill the shell, are you sure? (y/n): ");
 
         // If they are sure, exit the shell
         if (answer == 'y') {
@@ -141,264 +844,1202 @@ void mykill(int pid) {
 
     // Don't let user kill below 0 - bad things happen
     // If we couldn't kill the process, print an error message
-    // If it could, it will be handled in childdead signal handler
-    if (pid <= 0 || kill(pid, SIGTERM) != 0) {
+    // One of ours is signalled through its pidfd, so it can't be some other process that got its pid
+    // One that was already killed and hasn't died yet is ignoring SIGTERM, so it gets SIGKILL
+    struct node *killed = (pid > 0) ? find(pid, &pid_list) : NULL;
+    int sig = (killed != NULL && killed->killed) ? SIGKILL : SIGTERM;
+    if (pid <= 0 || ((killed != NULL) ? signalprocess(killed, sig) : kill(pid, sig)) != 0) {
         printf("Unable to kill %d\n", pid);
         return;
     }
-    printf("You have killed process %d\n", pid);
-    // Remove the process from the queue
-    delete(pid, &pid_list);
+    // A preempted process is stopped, it has to be continued to see the SIGTERM
+    if (killed != NULL) { signalprocess(killed, SIGCONT); }
+    else { kill(pid, SIGCONT); }
+    if (sig == SIGKILL) { printf("You have killed process %d with SIGKILL\n", pid); }
+    else { printf("You have killed process %d\n", pid); }
+    trace(TRACE_KILL, pid, (killed != NULL) ? killed->name : NULL, (killed != NULL) ? killed->worker : NO_SLOT, sig, &tracer);
+
+    // It is reaped and removed from the queue by the loop once it dies, through its pidfd or SIGCHLD
+    // Nothing waits for it here, one that catches SIGTERM would hold up everything else
+    if (killed != NULL) { killed->killed = 1; }
+}
+
+
+// Waits for a killed process to die and reaps it, it gets SIGKILL if it is still alive after KILL_GRACE msec
+// Only for exiting, the loop isn't running anymore to reap it
+void awaitdeath(struct node *stage) {
+    int pid = stage->pid, status;
+    struct rusage usage;
+
+    if (stage->pidfd != -1) {
+        struct pollfd pfd = { stage->pidfd, POLLIN, 0 };
+        if (poll(&pfd, 1, KILL_GRACE) == 0) {
+            signalprocess(stage, SIGKILL);
+            poll(&pfd, 1, -1);
+        }
+        reap(stage);
+        return;
+    }
 
-    // Wait for the process to die - once it does die 
-    // We will resume from here once we get the signal
-    pause();
+    // Without a pidfd it can only be waited for by its pid
+    int got;
+    memset(&usage, 0, sizeof(usage));
+    for (int waited = 0; (got = wait4(pid, &status, WNOHANG, &usage)) == 0; waited += 10) {
+        if (waited == KILL_GRACE) { kill(pid, SIGKILL); }
+        usleep(10000);
+    }
+    // Nothing to reap if it isn't our child, it is gone either way
+    if (got != pid) { status = STATUS_UNKNOWN; }
+    childexited(pid, status, &usage);
 }
 
 
 // Kills all the processes in the queue (if wanted)and exits the shell
 void myexit() {
     // No processes running, exit
-    if (pid_list.head == NULL) { exit(EXIT_SUCCESS); }
+    if (isempty(&pid_list)) {
+        run = 0;
+        return;
+    }
 
     // If there are still processes running, ask the user if they want to kill them
-    char answer;
-    do {
-        printf("There are still living processes. Do you want to kill them? (y/n): ");
-        scanf(" %c", &answer);
-        // print char for debug
-        answer = tolower(answer);
-    } while (answer != 'y' && answer != 'n');
+    char answer = ask("There are still living processes. Do you want to kill them? (y/n): ");
 
     // We exiting no matter what
     run = 0;
 
     // User did not want to kill the processes, bad move but user is always right
-    if (answer == 'n') { printf("Exiting without killing processes.\n"); }
+    // The next shell adopts them from the journal, and runs the ones that were still waiting
+    if (answer == 'n') {
+        printf("Exiting without killing processes.\n");
+        if (journal.fd != -1) { printf("They are kept in %s for the next shell to pick up.\n", journal.path); }
+    }
     // If did want to kill, kill all that are still alive
     if (answer == 'y') { 
-        while (pid_list.head != NULL) { 
-            // If not a valid pid, dequeue and continue - don't kill a non-living process
-            if (pid_list.head->pid == NO_PID) { 
-                dequeue(&pid_list);
-                continue; 
-            }
-            mykill(pid_list.head->pid); 
-        } 
+        // Everything with a pid is living, even if it was preempted, those are stopped but living
+        // They are all killed at once and then waited for, a preempted job leaves the queue with its last stage
+        for (int i = 0; i < pid_list.index_cap; i++) {
+            for (struct node *stage = pid_list.index[i]; stage != NULL; stage = stage->next) { mykill(stage->pid); }
+        }
+        while (pid_list.count != 0) {
+            int i = 0;
+            while (pid_list.index[i] == NULL) { i++; }
+            awaitdeath(pid_list.index[i]);
+        }
+        // Processes still waiting are not living, dequeue them - don't kill a non-living process
+        while (peek(&pid_list) != NULL) {
+            journalfinish(&journal, peek(&pid_list)->entry);
+            finishjob(peek(&pid_list), 0);
+            dequeue(&pid_list);
+        }
     }
 }
 
 
-// Assumes top of queue is the process to run
-void runprocess() {
-    // If the queue is empty, return
-    if (pid_list.head == NULL) { return; }
-    // If there already is a process running, return
-    if (curr_proc_pid != NO_CURR_PID) { return; }
-
-    // Set the current process to the head of the queue
-    curr_proc_node = pid_list.head;
+// Runs the given node in the given slot, and every stage piped from it
+// Each stage's stdout goes into the next one's stdin, a background job's output is captured
+// Returns 0 if the process couldn't be started, or was answered from the cache, the node is dropped
+int startprocess(struct node *curr_proc_node, int slot) {
+    // A job just like it may have finished while it waited
+    if (fromcache(curr_proc_node)) { return 0; }
+    // It was looked up and has to run after all
+    if (curr_proc_node->key != NULL) { cache.misses++; }
+
+    struct capture *log = curr_proc_node->bg ? opencapture(&logs) : NULL;
+    int fds[3], pipe_fds[2], in = -1;
+    long time = now();
+
+    // Every stage goes in one group, so the limits are on the whole job
+    int group_fd = newgroup(&groups, curr_proc_node->cpu_max, curr_proc_node->mem_max, &curr_proc_node->group);
+
+    for (struct node *stage = curr_proc_node; stage != NULL; stage = stage->pipe) {
+        // Read from the stage before, write into the one after or the log
+        fds[STDIN_FILENO] = in;
+        fds[STDOUT_FILENO] = (log != NULL) ? log->write_fd : -1;
+        fds[STDERR_FILENO] = (log != NULL) ? log->write_fd : -1;
+        if (stage->pipe != NULL && pipe2(pipe_fds, O_CLOEXEC) == 0) { fds[STDOUT_FILENO] = pipe_fds[1]; }
+        else { pipe_fds[0] = pipe_fds[1] = -1; }
+
+        // Start the process with whichever launcher was picked (-l)
+        int pidfd;
+        pid_t pid = launch(launcher_type, stage->name, stage->args, stage->bg, slots[slot].cpu, fds, group_fd, use_pidfds ? &pidfd : NULL);
+
+        // Nothing would ever reap a process without a pidfd, so it can't be kept
+        if (pid > 0 && use_pidfds && pidfd == -1) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            pid = -1;
+        }
 
-    // Enter new process, the head is the current process
-    // As we can only store 1 process at a time (the head)
+        // Only the stages keep their ends of the pipes
+        if (in != -1) { close(in); }
+        if (pipe_fds[1] != -1) { close(pipe_fds[1]); }
+        in = pipe_fds[0];
 
-    // IN NEW PROCESS
-    if ((curr_proc_node->pid = fork()) == 0) {
-        // Silence the output if the process is in the background
-        if (curr_proc_node->args[3] != NULL && strcmp(curr_proc_node->args[3], "&") == 0) {
-            // Detach the process from the terminal
-            setsid();
-            
-            // Run process in the background, i.e. no output/input in terminal
-            close(STDIN_FILENO);
-            close(STDOUT_FILENO);
-            close(STDERR_FILENO);
+        // The stages around it see the pipe close, and carry on without it
+        if (pid < 0) {
+            printf("Unable to run %s\n", stage->name);
+            curr_proc_node->failed = 1;
+            continue;
         }
 
-        // Run the process/program based on the name
-        execv(curr_proc_node->name, curr_proc_node->args);
-        // Should never get here, if we do, something went wrong
-        exit(-1);
+        // IN SHELL
+        // Index the node by its pid, so it can be found again when it dies or is killed
+        setpid(stage, pid, &pid_list);
+        if (use_pidfds) { watchprocess(stage, pidfd); }
+        // EDF, the kernel keeps the deadline too if it will (-D)
+        if (sched_type == EDF && curr_proc_node->deadline != 0) { mapdeadline(pid, curr_proc_node->time, curr_proc_node->deadline - time, &deadlines); }
+        stage->worker = slot;
+        stage->started = time;
+        stage->first_started = time;
+        curr_proc_node->live++;
+    }
+    if (in != -1) { close(in); }
+    if (group_fd != -1) { close(group_fd); }
+
+    // Nothing started, drop the whole job
+    if (curr_proc_node->live == 0) {
+        jobs_done++;
+        jobs_failed++;
+        removegroup(curr_proc_node->group, &groups);
+        journalfinish(&journal, curr_proc_node->entry);
+        finishjob(curr_proc_node, 0);
+        if (log != NULL) {
+            closecapture(log, &logs);
+            free(log);
+        }
+        freejob(curr_proc_node);
+        return 0;
     }
 
-    // IN SHELL
-    // Update the current process we are working on
-    curr_proc_pid = curr_proc_node->pid;
+    // The job goes by the pid of its first stage that started
+    struct node *first = curr_proc_node;
+    while (first->pid == NO_PID) { first = first->pipe; }
 
-    // Set a flag saying we are running in foreground
-    io_occupied = (curr_proc_node->args[3] == NULL);
+    // Keep the output under that pid, and read it as it comes
+    if (log != NULL && keepcapture(log, first->pid, &logs)) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = log->fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, log->fd, &ev);
+    }
 
+    // The slot is now taken by this job
+    slots[slot].node = curr_proc_node;
+    curr_proc_node->worker = slot;
+    curr_proc_node->started = time;
+    curr_proc_node->first_started = time;
+    num_running++;
+    journalstart(&journal, curr_proc_node);
+    trace(TRACE_DISPATCH, first->pid, first->name, slot, pid_list.size, &tracer);
+
+    // Count it if we are running in foreground
+    if (!curr_proc_node->bg) { io_occupied++; }
     // Let the user know the process is running in background
-    if (!io_occupied) { 
-        printf("Running process %s (PID: %d) in background!\n", curr_proc_node->name, curr_proc_pid); 
+    else { 
+        printf("Running process %s (PID: %d) in background!\n", first->name, first->pid); 
+    }
+    return 1;
+}
+
+
+// Continues a preempted process in the given slot, with every stage of its pipeline
+void resumeprocess(struct node *curr_proc_node, int slot) {
+    long time = now();
+
+    slots[slot].node = curr_proc_node;
+    num_running++;
+    trace(TRACE_RESUME, curr_proc_node->pid, curr_proc_node->name, slot, pid_list.size, &tracer);
+
+    for (struct node *stage = curr_proc_node; stage != NULL; stage = stage->pipe) {
+        stage->worker = slot;
+        stage->started = time;
+        if (!alive(stage)) { continue; }
+
+        // It may have been stopped in a slot on another CPU
+        pincpu(stage->pid, slots[slot].cpu);
+        signalprocess(stage, SIGCONT);
+    }
+}
+
+
+// Stops the process running in the given slot and puts it back in the queue
+// It is requeued with what is left of its estimated time
+void preempt(int slot, long time) {
+    struct node *curr_proc_node = slots[slot].node;
+
+    // Every stage of a pipeline is stopped, the leader keeps the time of the whole job
+    for (struct node *stage = curr_proc_node->pipe; stage != NULL; stage = stage->pipe) {
+        if (alive(stage)) {
+            signalprocess(stage, SIGSTOP);
+            stage->ran += time - stage->started;
+        }
+        stage->worker = NO_SLOT;
+    }
+    if (alive(curr_proc_node)) { signalprocess(curr_proc_node, SIGSTOP); }
+
+    curr_proc_node->ran += time - curr_proc_node->started;
+    curr_proc_node->time -= time - curr_proc_node->started;
+    if (curr_proc_node->time < 0) { curr_proc_node->time = 0; }
+
+    // MLFQ, it drops a level if it used up its quantum, not if it was pushed out by a higher level
+    int quantum = timeslice(curr_proc_node, &pid_list);
+    if (quantum != 0 && time - curr_proc_node->started >= quantum) { demote(curr_proc_node, &pid_list); }
+
+    trace(TRACE_PREEMPT, curr_proc_node->pid, curr_proc_node->name, slot, time - curr_proc_node->started, &tracer);
+    slots[slot].node = NULL;
+    curr_proc_node->worker = NO_SLOT;
+    num_running--;
+
+    requeue(curr_proc_node, &pid_list);
+    charge(curr_proc_node, time - curr_proc_node->started, &pid_list);
+}
+
+
+// Returns 1 if the scheduler preempts, and has to look at the running processes on a tick
+// EDF preempts too, but only when a job comes in, a deadline doesn't change while it waits
+int preemptive() {
+    return sched_type == RR || sched_type == SRTF || sched_type == MLFQ || sched_type == FAIR;
+}
+
+// Wakes the loop up in a while to try held jobs again
+// The preemptive schedulers already have a tick that does
+void retrylater() {
+    if (preemptive()) { return; }
+
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_nsec = PSI_INTERVAL * 1000000;
+    timerfd_settime(timer_fd, 0, &timer, NULL);
+}
+
+// Runs a process taken off the queue in a slot
+// If it already started it was preempted, so continue it instead
+// Returns 0 if it couldn't be started
+int runin(struct node *curr_proc_node, int slot) {
+    if (curr_proc_node->live != 0) {
+        resumeprocess(curr_proc_node, slot);
+        return 1;
+    }
+    return startprocess(curr_proc_node, slot);
+}
+
+// Fills every free slot with the top of the queue
+// FCFS/SJF/RR/SRTF/MLFQ/FAIR/EDF order decides which process gets the next free slot
+// With a run queue per slot (-q) it is the top of the slot's own, or of the longest one if its own is empty
+void runprocess() {
+    for (int i = 0; i < num_slots && pid_list.size != 0; i++) {
+        // If there already is a process running in the slot, skip it
+        if (slots[i].node != NULL) { continue; }
+
+        // A new job waits while the machine is stalled, unless nothing of ours is running at all
+        if (peekfor(i, &pid_list)->live == 0 && num_running != 0 && saturated(&psi, now())) {
+            psi.held++;
+            retrylater();
+            return;
+        }
+
+        // Taking it off the heap, it stays in the queue through the pid index
+        // If it couldn't be started, try the next one in the same slot
+        if (!runin(popfor(i, &pid_list), i)) { i--; }
     }
 }
 
 
-// Enqques a process with the given parameters
-// Assumes the input is in the form of exec p1(n1,qt1) p2(n2,qt2) ...
-void exec(char *input) {
-    // Keeps tracks of arguments
+// Preempts whatever has to be preempted, then fills the free slots
+// Does nothing more than runprocess() for FCFS and SJF
+void schedule() {
+    long time = now();
     int i;
 
-    // Array of arguments, 10 can be any number, it's just a placeholder (should be more than 4)
-    // args[0] = program name, args[1] = n, args[2] = qt, args[3] = bg
-    char *args[10];
-    // Temporary string to hold the input
-    char *curr_arg;
+    // MLFQ, every so often everything goes back to the top level, running or not
+    if (sched_type == MLFQ && time - last_boost >= MLFQ_BOOST) {
+        boost(&pid_list);
+        for (i = 0; i < num_slots; i++) {
+            if (slots[i].node != NULL) { slots[i].node->level = 0; }
+        }
+        last_boost = time;
+    }
+
+    // RR/MLFQ/FAIR, stop every process that has used up its quantum if something is waiting for its slot
+    for (i = 0; i < num_slots && pid_list.size != 0; i++) {
+        if (slots[i].node == NULL || peekfor(i, &pid_list) == NULL) { continue; }
+
+        int quantum = timeslice(slots[i].node, &pid_list);
+        if (quantum != 0 && time - slots[i].node->started >= quantum) { preempt(i, time); }
+    }
+    runprocess();
+
+    // SRTF, while the shortest waiting process has less left than the longest running one, swap them
+    // MLFQ, the same with the highest waiting level against the lowest running one
+    // EDF, the same with the waiting process due first against the running one due last
+    while (peek(&pid_list) != NULL && num_running == num_slots) {
+        int worst = 0;
+        long curr_rank, worst_rank = 0;
+        for (i = 0; i < num_slots; i++) {
+            curr_rank = rank(slots[i].node, time - slots[i].node->started, &pid_list);
+            if (i == 0 || curr_rank > worst_rank) {
+                worst = i;
+                worst_rank = curr_rank;
+            }
+        }
+
+        // The waiting process takes the slot, whichever run queue it waited in
+        // A new one isn't started in place of another while the machine is stalled
+        struct node *best = peek(&pid_list);
+        if (!preempts(best, worst_rank, &pid_list)) { break; }
+        if (best->live == 0 && saturated(&psi, now())) { break; }
+        preempt(worst, time);
+        take(best, worst, &pid_list);
+        if (!runin(best, worst)) { runprocess(); }
+    }
+}
+
+
+// Creates the node of a process with the given parameters, it goes into the queue once its whole line is parsed
+// Assumes the input is in the form of p(n,qt,bg), returns NULL if it isn't
+// If prev is given the process is piped from it, as the next stage of its pipeline
+struct node *exec(struct view word, struct node *prev) {
+    // Array of arguments
+    // args[0] = program name, args[1] = n, args[2] = qt, last one = bg if it is &
+    struct view args[MAX_ARGS];
+    struct view keys[MAX_ATTRS], vals[MAX_ATTRS];
+    struct view id = { NULL, 0 }, after = { NULL, 0 }, group = { NULL, 0 }, name;
+    int i, cpu_max = 0, weight = 0;
+    long mem_max = 0, deadline = 0;
+
+    // Options of the job are in [key=value,...] after it
+    //      cpu - percent of one CPU it may use, mem - memory it may use, like 64M
+    //      id - name later jobs can come after it by, after - names of the jobs it comes after, like a+b
+    //      group - group it gets its fair share with, weight - how big a share the group gets, for FAIR
+    //      deadline - when it has to be done by, like 500ms, 2s or @SECS, for EDF
+    int num_attrs = parseattrs(&word, keys, vals);
+    if (num_attrs < 0) { return NULL; }
+    for (i = 0; i < num_attrs; i++) {
+        if (vieweq(keys[i], "cpu") && viewint(vals[i]) > 0) { cpu_max = viewint(vals[i]); }
+        else if (vieweq(keys[i], "mem") && viewsize(vals[i]) > 0) { mem_max = viewsize(vals[i]); }
+        else if (vieweq(keys[i], "id")) { id = vals[i]; }
+        else if (vieweq(keys[i], "after")) { after = vals[i]; }
+        else if (vieweq(keys[i], "group") && vals[i].len != 0) { group = vals[i]; }
+        else if (vieweq(keys[i], "weight") && viewint(vals[i]) > 0 && viewint(vals[i]) <= STRIDE1) { weight = viewint(vals[i]); }
+        else if (vieweq(keys[i], "deadline") && parsedeadline(vals[i], now()) > 0) { deadline = parsedeadline(vals[i], now()); }
+        else { return NULL; }
+    }
+
+    // A job has one name, not taken by a job that isn't done, and only comes after jobs that already came
+    struct task *t = (prev != NULL) ? prev->leader->task : NULL;
+    if (id.s != NULL) {
+        if (t != NULL && t->name != NULL) { return NULL; }
+        if (findtask(id, &graph) != NULL && findtask(id, &graph)->state == TASK_WAITING) { return NULL; }
+    }
+    for (struct view list = after; list.s != NULL && list.len != 0;) {
+        if (!nextitem(&list, '+', &name) || findtask(name, &graph) == NULL) { return NULL; }
+    }
 
     // Parse the input into the executable and its arguments
     // Format is p(n,qt,bg)
     //      Get the program name p, and the arguments n, qt, and bg which are comma seperated
     //      background is optional, if it is not given, the process will run in the foreground
-    //      We don't need to check if the input is valid because we assume it is
-    curr_arg = strtok(input, "(");
-    args[0] = curr_arg;
-    // Add the arguments to the array
-    for (i = 1; (curr_arg = strtok(NULL, ",")) != NULL; i++) { args[i] = curr_arg; }
-    // Remove the end parenthesis from the last argument, and make next one null
-    args[i - 1] = strtok(args[i - 1], ")");
-    // Last argument is null to indicate end of arguments
-    args[i] = NULL;
-
-    // Push the process to the queue
-    enqueue(args[0], args, &pid_list);
+    // The args still point into the input, enqueue copies them
+    int argc = parseprogram(word, args);
+    if (argc == 0) { return NULL; }
+
+    // Start a new job, or put the process onto the end of its pipeline
+    struct node *curr_node = (prev != NULL) ? pipeto(prev, args, argc, &pid_list) : newnode(args, argc, &pid_list);
+    curr_node->arrived = now();
+
+    // Limits and dependencies are on the whole pipeline, whichever stage they are given on
+    struct node *leader = curr_node->leader;
+    if (cpu_max != 0) { leader->cpu_max = cpu_max; }
+    if (mem_max != 0) { leader->mem_max = mem_max; }
+    if (deadline != 0) { leader->deadline = deadline; }
+    // A weight is the group's, the last job to give one sets it
+    if (group.s != NULL) { leader->share = getshare(group, &pid_list.shares); }
+    if (weight != 0) { setweight((leader->share != NULL) ? leader->share : defaultshare(&pid_list.shares), weight, &pid_list.shares); }
+    if (id.s == NULL && after.s == NULL) { return curr_node; }
+
+    // The jobs it comes after are found before it takes its name, it may take the name of one of them
+    if (leader->task == NULL) { newtask(leader); }
+    while (nextitem(&after, '+', &name)) { addafter(leader->task, findtask(name, &graph)); }
+    if (id.s != NULL) { nametask(leader->task, id, &graph); }
+    return curr_node;
 }
 
+// Puts a job into the queue once its whole line is parsed
+// A job that comes after others is held until they are done, and never runs if one of them failed
+// A background job the cache has the result of is done right away
+// Under EDF a job that can't make its deadline is flagged, or rejected with -R
+void submit(struct node *job) {
+    journalenqueue(&journal, job);
+
+    int held = (job->task != NULL) ? holdtask(job->task, &graph) : 0;
+    if (held == 0) {
+        if (fromcache(job)) { return; }
+        if (!meetsdeadline(job, 1)) {
+            rejectjob(job);
+            return;
+        }
+        heapinsert(job, &pid_list);
+        trace(TRACE_ENQUEUE, job->pid, job->name, NO_SLOT, pid_list.size, &tracer);
+    }
+    else if (held < 0) { canceljob(job); }
+    else { lengthen(job->task, &graph, &pid_list); }
+}
 
-void childdead(int signum){
-    int dead_pid, status;
+// Enqueues every program on a line, p1(n1,qt1) p2(n2,qt2) | p3(n3,qt3) ...
+// A | pipes the program before it into the one after it, and they run as one job
+// Stops at a word starting with #, invalid is called with the number of each word that isn't valid
+// Each job is submitted once all its stages are parsed, before the next one, so the next one can come after it
+// Returns how many programs were enqueued
+int execline(struct view line, void (*invalid)(int)) {
+    struct view word;
+    struct node *prev = NULL, *job = NULL;
+    int i, piped = 0, added = 0;
+
+    for (i = 1; nextword(&line, &word) && word.s[0] != '#'; i++) {
+        // A | has to come right after a valid program
+        if (vieweq(word, "|")) {
+            if (prev == NULL || piped) { invalid(i); }
+            else { piped = i; }
+            continue;
+        }
 
-    // Collect the dead child's pid
-    dead_pid = wait(&status);
-    // Formatting
-    printf("The child %d is dead\n", dead_pid);
+        // A new job, nothing more can be piped onto the one before it
+        if (!piped && job != NULL) {
+            submit(job);
+            job = NULL;
+        }
 
-    // Print out and error message if the process exited with a non-zero status
-    // Helps debugging if process fails (for user not for shell)
-    int exit_status;
-    if ((exit_status = WEXITSTATUS(status)) != 0) {
-        printf("An error occured in the executing process\n");
-        printf("Code: Process %d exited with status %d\n", dead_pid, exit_status);
+        prev = exec(word, piped ? prev : NULL);
+        piped = 0;
+        if (prev == NULL) {
+            invalid(i);
+            continue;
+        }
+        added++;
+        job = prev->leader;
     }
-    
-    // Remove the process from the queue 
-    // Not using dequeue because if we call kill, it will remove the process inproperly
-    delete(dead_pid, &pid_list);
-    // If the process that died was the current process, set the current process to 0
-    // and its node to NULL
-    // Will always happen in our case since we can only run 1 process at a time
-    if (dead_pid == curr_proc_pid) { 
-        curr_proc_pid = NO_CURR_PID; 
-        curr_proc_node = NULL;
+    if (job != NULL) { submit(job); }
+
+    // Nothing to pipe into
+    if (piped) { invalid(piped); }
+    return added;
+}
+
+// Error for an invalid program given to exec
+void badexec(int arg) {
+    printf("Invalid exec for arg %d. Type 'help exec' for help.\n\n", arg);
+}
+
+// Error for an invalid job in the batch
+void badjob(int arg) {
+    (void)arg;
+    printf("Invalid job on line %ld of the batch. Type 'help batch' for help.\n", batch_line);
+    batch_invalid++;
+}
+
+
+// Reaps every dead child, not just one, only used when there are no pidfds
+// SIGCHLDs that arrive together are merged into one, so keep waiting until none are left
+void childdead() {
+    int dead_pid, status, reaped = 0;
+    struct rusage usage;
+
+    // wait4 also gives us what each child used, for accounting
+    while ((dead_pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        childexited(dead_pid, status, &usage);
+        reaped++;
     }
 
     // Run next process if there is one, and if shell is supposed to run
-    // If there isn't free up the io flag
-    if (pid_list.head != NULL && run) { 
+    if (reaped != 0 && peek(&pid_list) != NULL && run) { 
         printf("\n"); // Formatting
-        runprocess(); 
+        schedule(); 
+    }
+}
+
+
+// Takes over a process the last shell started, as long as it is still the same process
+// The pid may have gone to something else since, the pidfd pins down whichever process has it now
+// Returns 1 if it was adopted
+int adopt(struct node *stage, int pid, unsigned long long start) {
+    if (pid == NO_PID) { return 0; }
+
+    int fd = pidfdopen(pid);
+    if (fd < 0) { return 0; }
+    if (procstart(pid) != start) {
+        close(fd);
+        return 0;
+    }
+
+    setpid(stage, pid, &pid_list);
+    watchprocess(stage, fd);
+    return 1;
+}
+
+// Puts a recovered job back into the graph, with its name and the jobs it still comes after
+// jobs holds every job recovered so far by id, a job it came after that is gone finished while no shell was running
+// and is taken to have succeeded
+// Returns 1 if the job is held
+int rejoin(struct node *leader, struct record *r, struct node **jobs) {
+    uint64_t *deps = journaldeps(r);
+    char *name = journalname(r);
+    if (r->deps == 0 && name[0] == '\0') { return 0; }
+
+    struct task *t = newtask(leader);
+    for (int i = 0; i < r->deps; i++) {
+        if (deps[i] < journal.head->base || deps[i] >= r->id) { continue; }
+
+        struct node *before = jobs[deps[i] - journal.head->base];
+        if (before != NULL && before->task != NULL) { addafter(t, before->task); }
+    }
+    if (name[0] != '\0') {
+        struct view id = { name, strlen(name) };
+        nametask(t, id, &graph);
+    }
+
+    if (holdtask(t, &graph) != 1) { return 0; }
+    lengthen(t, &graph, &pid_list);
+    return 1;
+}
+
+// Rebuilds the queue from the journal the last shell left behind
+// Jobs that were waiting are queued again, in the order they came in
+// Jobs that had started are adopted if they are still alive, and stopped until they get a slot like a preempted job
+// Jobs that had started before a reboot were killed by it, so they are queued again as if they never started
+// Jobs that came after others are held again until those are done
+void recover() {
+    long time = now(), waiting = 0, adopted = 0, lost = 0, requeued = 0;
+    struct record *enqueued, *started;
+    unsigned long long start;
+    struct node **jobs = (struct node **)calloc(journal.head->next - journal.head->base + 1, sizeof(struct node *));
+    // Compacting would move the ids jobs is indexed by, and forget the reboot
+    journal.replaying = 1;
+
+    for (long id = journal.head->base; id < (long)journal.head->next; id++) {
+        if (!journalentry(&journal, id, &enqueued, &started)) { continue; }
+
+        struct node *leader = journaljob(enqueued, &pid_list);
+        if (leader == NULL) { continue; }
+        // The clock starts over with every boot
+        if (journal.rebooted) {
+            for (struct node *stage = leader; stage != NULL; stage = stage->pipe) { stage->arrived = time; }
+        }
+
+        // The reboot killed it, it runs again from the start
+        if (started != NULL && journal.rebooted) {
+            journalrequeue(&journal, id);
+            started = NULL;
+            requeued++;
+        }
+
+        if (started == NULL) {
+            jobs[id - journal.head->base] = leader;
+            if (!rejoin(leader, enqueued, jobs)) { heapinsert(leader, &pid_list); }
+            waiting++;
+            continue;
+        }
+
+        int i = 0;
+        for (struct node *stage = leader; stage != NULL; stage = stage->pipe, i++) {
+            int pid = stagepid(started, i, &start);
+            stage->first_started = started->time;
+            if (adopt(stage, pid, start)) { leader->live++; }
+        }
+
+        // It finished while no shell was watching it
+        if (leader->live == 0) {
+            journalfinish(&journal, id);
+            freejob(leader);
+            lost++;
+            continue;
+        }
+
+        for (struct node *stage = leader; stage != NULL; stage = stage->pipe) {
+            if (alive(stage)) { signalprocess(stage, SIGSTOP); }
+        }
+        if (!leader->bg) { io_occupied++; }
+        // It started, so everything it came after was already done
+        jobs[id - journal.head->base] = leader;
+        rejoin(leader, enqueued, jobs);
+        heapinsert(leader, &pid_list);
+        adopted++;
     }
-    else { io_occupied = 0; }
+    free(jobs);
+
+    // Start the journal over with only what is live
+    journal.replaying = 0;
+    compactjournal(&journal);
+    if (waiting + adopted + lost == 0) { return; }
+
+    printf("Recovered from %s in %ld msec: %ld waiting jobs", journal.path, now() - time, waiting);
+    if (requeued != 0) { printf(" (%ld killed by a reboot, to run again)", requeued); }
+    printf(", %ld adopted", adopted);
+    if (lost != 0) { printf(", %ld finished while no shell was running", lost); }
+    printf("\n");
 }
 
 
 // Suspends all processes
-void susp(int signum) {
+void susp() {
     fg_suspended = 1;
+    trace(TRACE_STOP, getpid(), NULL, NO_SLOT, num_running, &tracer);
     printf("\nAll processes supspended\n");
 }
 
 
 // Continues all processes
-void cont(int signum) {
+// The shell takes no more input until the running processes are done, or it is suspended again
+void cont() {
     fg_suspended = 0;
+    waking = 1;
+    trace(TRACE_CONT, getpid(), NULL, NO_SLOT, num_running, &tracer);
     printf("\nWaking all processes...\n");
-    while (curr_proc_pid != NO_CURR_PID && fg_suspended != 1) { pause(); }
+}
+
+
+// Reads what signals have arrived from the signalfd and handles them
+void handlesignals() {
+    struct signalfd_siginfo info;
+
+    while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGCHLD) { childdead(); }
+        else if (info.ssi_signo == SIGTSTP) { susp(); }
+        else if (info.ssi_signo == SIGQUIT) { cont(); }
+    }
+}
+
+
+// Timer tick for the preemptive schedulers
+void tick() {
+    uint64_t expirations;
+
+    if (read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations) && run) { schedule(); }
+}
+
+
+// Returns 1 if the shell should be taking commands
+int accepting() {
+    // Done waking once nothing is running, or if suspended again
+    if (waking && (num_running == 0 || fg_suspended)) { waking = 0; }
+
+    return run && io_occupied == 0 && !waking;
+}
+
+
+// Prints the prompt, once per command
+void prompt() {
+    if (prompted) { return; }
+
+    printf("\n=>");
+    fflush(stdout);
+    prompted = 1;
+}
+
+
+// Adds or removes a source from what epoll waits on
+// Keeps us from reading input while a foreground process is running
+// Files are never added, they are read whenever they are watched
+void watch(struct source *src, int watch) {
+    if (watch == src->watching) { return; }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = src->r.fd;
+    if (!src->is_file) { epoll_ctl(epoll_fd, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, src->r.fd, &ev); }
+    src->watching = watch;
+}
+
+
+// Starts reading jobs from a batch file, fd is already open
+void startbatch(int fd) {
+    opensource(&batch, fd);
+    // Never block on a pipe that has nothing in it yet, we wait for it in the epoll
+    if (!batch.is_file) { fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); }
+
+    batch_line = 0;
+    batch_invalid = 0;
+    batch_done_base = jobs_done;
+    batch_failed_base = jobs_failed;
+    batch_hits_base = cache.hits;
+    batch_misses_base = cache.misses;
+}
+
+// Stops reading the batch file once it is all read
+void closebatch() {
+    watch(&batch, 0);
+    if (batch.r.fd != STDIN_FILENO) { close(batch.r.fd); }
+    free(batch.r.buf);
+    batch.r.fd = -1;
+}
+
+// Returns 1 if there is a batch that hasn't been all read or hasn't finished running
+int batchrunning() {
+    return batch.r.fd != -1;
+}
+
+// Enqueues jobs from the batch as slots free up
+// At most one job per slot waits in the queue, so SJF still has a choice between them
+// Each line is a job p(n,qt,...), blank lines and lines starting with # are skipped
+void admit() {
+    struct view line;
+    int added = 0;
+
+    while (batch.r.fd != -1 && pid_list.size < num_slots) {
+        if (!readline(&batch.r, &line)) {
+            // Out of lines, a file can be read right away but a pipe has to wait for the epoll
+            if (batch.r.closed || !batch.is_file) { break; }
+            readmore(&batch);
+            continue;
+        }
+
+        batch_line++;
+        added += execline(line, badjob);
+    }
+
+    if (added != 0) { schedule(); }
+}
+
+// Reports the batch once it is all read and everything has run
+void finishbatch() {
+    if (batch.r.fd == -1 || !batch.r.closed || buffered(&batch.r) || !isempty(&pid_list)) { return; }
+
+    closebatch();
+    printf("\nBatch done: %ld jobs, %ld failed, %ld invalid lines", jobs_done - batch_done_base, jobs_failed - batch_failed_base, batch_invalid);
+    if (cache.dir[0] != '\0') { printf(", %ld cache hits and %ld misses", cache.hits - batch_hits_base, cache.misses - batch_misses_base); }
+    printf("\n");
+}
+
+// Runs the jobs in a batch file
+void mybatch(struct view file) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%.*s", (int)file.len, file.s);
+
+    if (batchrunning()) {
+        printf("A batch is already running\n");
+        return;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        printf("Unable to open %s\n", path);
+        return;
+    }
+    startbatch(fd);
+    admit();
+}
+
+
+// Runs one line of input
+// The words are views into the input buffer, nothing is copied to parse them
+void command(struct view line) {
+    struct view cmd, word;
+
+    // Empty line, nothing to do
+    if (!nextword(&line, &cmd)) { return; }
+    // Number of arguments
+    int arg_num = countwords(line);
+
+    prompt();
+    printf("\n");   // Formatting
+    prompted = 0;
+
+    // Shows current verison of shell
+    if (vieweq(cmd, "ver") && arg_num == 0) { ver(); }
+    // Prints the list of commands
+    else if (vieweq(cmd, "help") && arg_num == 0) { help(); }
+    // Prints the help for a specific command
+    else if (vieweq(cmd, "help") && arg_num == 1) {
+        nextword(&line, &word);
+        helpcmd(word);
+    }
+    // Prints the LIVING processes (the shell and one per slot at most)
+    else if (vieweq(cmd, "ps") && arg_num == 0) { ps();}
+    // Prints what the running processes are doing
+    else if (vieweq(cmd, "top") && arg_num <= 1) {
+        word.len = 0;
+        nextword(&line, &word);
+        mytop(word);
+    }
+    // Prints the slot time each group has used and is entitled to
+    else if (vieweq(cmd, "shares") && arg_num == 0) { myshares(); }
+    // Records what the scheduler does, or dumps it
+    else if (vieweq(cmd, "trace") && (arg_num == 1 || arg_num == 2)) {
+        struct view file = { NULL, 0 };
+        nextword(&line, &word);
+        nextword(&line, &file);
+        mytrace(word, file);
+    }
+    // Kills a process with the given pid
+    else if (vieweq(cmd, "kill") && arg_num == 1) {
+        nextword(&line, &word);
+        mykill(viewint(word));
+    }
+    // Executes a process with the given parameters
+    else if (vieweq(cmd, "exec") && arg_num != 0) {
+        // First we will check if the exec is valid,
+        // If it is not, we will not execute that specific process
+        // We will just print an error message and continue to next input
+        execline(line, badexec);
+
+        // All processes have been added to the queue, fill the free slots
+        // With SRTF a new process may also take the slot of a longer running one
+        // When a process finishes, the next one will take its place
+        // No need to try to run each process individually - one call will suffice
+        schedule();
+    }
+    // Prints accounting of the finished jobs
+    else if (vieweq(cmd, "stats") && arg_num == 0) { mystats(); }
+    // Prints the output kept for a background job
+    else if (vieweq(cmd, "logs") && arg_num == 1) {
+        nextword(&line, &word);
+        mylogs(viewint(word));
+    }
+    // Runs the jobs in a batch file as slots free up
+    else if (vieweq(cmd, "batch") && arg_num == 1) {
+        nextword(&line, &word);
+        mybatch(word);
+    }
+    // Exits the shell
+    else if (vieweq(cmd, "exit") && arg_num == 0) { myexit(); }
+    // If the command is not recognized, print an error message
+    else { printf("No such command. Check help for help.\n"); }
+}
+
+
+// Runs one command from a client of the control socket
+// Only the ones that never wait on the terminal: exec, ps, top, shares, kill, stats, logs, trace, ver and help
+// Nothing is scheduled here, that happens once every client waiting has been served
+void request(struct view line) {
+    struct view cmd, word;
+
+    if (!nextword(&line, &cmd)) {
+        printf("No command given\n");
+        return;
+    }
+    int arg_num = countwords(line);
+
+    if (vieweq(cmd, "exec") && arg_num != 0) {
+        int added = execline(line, badexec);
+        if (added != 0) {
+            printf("Queued %d programs\n", added);
+            requested = 1;
+        }
+    }
+    else if (vieweq(cmd, "ps") && arg_num == 0) { ps(); }
+    else if (vieweq(cmd, "top") && arg_num <= 1) {
+        word.len = 0;
+        nextword(&line, &word);
+        mytop(word);
+    }
+    else if (vieweq(cmd, "shares") && arg_num == 0) { myshares(); }
+    else if (vieweq(cmd, "stats") && arg_num == 0) { mystats(); }
+    else if (vieweq(cmd, "trace") && (arg_num == 1 || arg_num == 2)) {
+        struct view file = { NULL, 0 };
+        nextword(&line, &word);
+        nextword(&line, &file);
+        mytrace(word, file);
+    }
+    else if (vieweq(cmd, "ver") && arg_num == 0) { ver(); }
+    else if (vieweq(cmd, "help") && arg_num == 0) { help(); }
+    else if (vieweq(cmd, "help") && arg_num == 1) {
+        nextword(&line, &word);
+        helpcmd(word);
+    }
+    else if (vieweq(cmd, "logs") && arg_num == 1) {
+        nextword(&line, &word);
+        mylogs(viewint(word));
+    }
+    // Only jobs of the shell, never the shell itself or anything else that has the pid
+    // The reply goes back once the signal is sent, the job is reaped and its slot refilled by the loop once it dies
+    else if (vieweq(cmd, "kill") && arg_num == 1) {
+        nextword(&line, &word);
+        if (viewint(word) <= 0 || find(viewint(word), &pid_list) == NULL) { printf("No job has pid %d\n", viewint(word)); }
+        else { mykill(viewint(word)); }
+    }
+    else { printf("Not allowed over the control socket, only exec, ps, top, shares, kill, stats, logs, trace, ver and help\n"); }
+}
+
+// Runs the commands a client has sent, the output of each one goes back to it as the reply
+void serve(int fd) {
+    char buf[CONTROL_MSG];
+    char *reply;
+    size_t len;
+
+    for (int i = 0; i < CONTROL_BATCH && isclient(fd, &control); i++) {
+        ssize_t n = readrequest(fd, buf, sizeof(buf));
+        if (n == 0) { return; }
+        if (n < 0) {
+            dropclient(fd, &control);
+            return;
+        }
+        // Only part of it was read, running that could do something else than was asked
+        if (n > (ssize_t)sizeof(buf)) {
+            char err[128];
+            int err_len = snprintf(err, sizeof(err), "Command of %zd bytes is longer than the %d allowed, not run\n", n, CONTROL_MSG);
+            sendreply(fd, err, err_len, &control);
+            continue;
+        }
+
+        // What the command prints goes into the reply instead of onto the terminal
+        // Only the stdio stream is swapped, the jobs still inherit the terminal as their fd 1
+        FILE *terminal = stdout;
+        fflush(stdout);
+        stdout = open_memstream(&reply, &len);
+        if (stdout == NULL) {
+            stdout = terminal;
+            dropclient(fd, &control);
+            return;
+        }
+
+        struct view line = { buf, (size_t)n };
+        request(line);
+        fclose(stdout);
+        stdout = terminal;
+
+        sendreply(fd, reply, len, &control);
+        free(reply);
+    }
 }
 
 
 // Driver function
 int main(int argc, char **argv) {
-    // Last args determines what type of scheduling we want
-    // Check if the user wants to use SJF scheduling
-    if (argc == 2 && strcmp(argv[1], "FCFS") == 0) { sched_type = FCFS; }
-    else { sched_type = SJF; }
+    int i;
 
-    // Input buffer
-    char input[15][30];
-    // Number of arguments
-    int arg_num, i;
+    // Args determine what type of scheduling we want and how many slots to run
+    //      FCFS/SJF/RR/SRTF/MLFQ/FAIR/EDF - scheduling type, SJF if not given
+    //      -j N        - run up to N processes at once, number of online CPUs if not given
+    //      -p          - pin each slot to its own CPU
+    //      -q          - give each slot its own run queue, stealing from the longest when it runs dry, implies -p
+    //      -l LAUNCHER - start processes with fork, spawn or vfork, spawn if not given
+    //      --batch [FILE] - run the jobs in FILE (stdin if not given) without taking commands, then exit
+    //      -P PERCENT  - hold new jobs while CPU or memory pressure is over PERCENT, PSI_LIMIT if not given, 0 for never
+    //      -J FILE     - keep the journal in FILE, $HOME/JOURNAL_FILE if not given
+    //      -S FILE     - bind the control socket to FILE, $HOME/CONTROL_FILE if not given
+    //      -C DIR      - keep the results of background jobs in DIR, and answer the same job again from there
+    //      -R          - reject jobs predicted to miss their deadline under EDF, instead of flagging them
+    //      -D          - give jobs with a deadline SCHED_DEADLINE under EDF, if the kernel allows it
+    char *batch_file = NULL;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "FCFS") == 0) { sched_type = FCFS; }
+        else if (strcmp(argv[i], "SJF") == 0) { sched_type = SJF; }
+        else if (strcmp(argv[i], "RR") == 0) { sched_type = RR; }
+        else if (strcmp(argv[i], "SRTF") == 0) { sched_type = SRTF; }
+        else if (strcmp(argv[i], "MLFQ") == 0) { sched_type = MLFQ; }
+        else if (strcmp(argv[i], "FAIR") == 0) { sched_type = FAIR; }
+        else if (strcmp(argv[i], "EDF") == 0) { sched_type = EDF; }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) { num_slots = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "-p") == 0) { pin_slots = 1; }
+        else if (strcmp(argv[i], "-q") == 0) { slot_queues = pin_slots = 1; }
+        else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) { psi_limit = atof(argv[++i]); }
+        else if (strcmp(argv[i], "-J") == 0 && i + 1 < argc) { journal_file = argv[++i]; }
+        else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) { control_file = argv[++i]; }
+        else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) { cache_dir = argv[++i]; }
+        else if (strcmp(argv[i], "-R") == 0) { reject_late = 1; }
+        else if (strcmp(argv[i], "-D") == 0) { kernel_deadlines = 1; }
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc && launcher(argv[i + 1]) != -1) { launcher_type = launcher(argv[++i]); }
+        else if (strcmp(argv[i], "--batch") == 0) {
+            interactive = 0;
+            // The file is optional, anything that isn't another option or a scheduler is it
+            if (i + 1 < argc && argv[i + 1][0] != '-' && !isscheduler(argv[i + 1])) {
+                batch_file = argv[++i];
+                // Reading commands from stdin instead would run something else than was asked for
+                if (access(batch_file, R_OK) != 0) {
+                    printf("Unable to read batch file %s\n", batch_file);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        else { printf("Unknown option %s\n", argv[i]); }
+    }
+    if (num_slots <= 0) { num_slots = sysconf(_SC_NPROCESSORS_ONLN); }
+    if (num_slots <= 0) { num_slots = 1; }
+
+    // Set up the slots, pinning them to the CPUs we are allowed to run on in turn
+    cpu_set_t allowed;
+    int num_cpus = 0;
+    if (pin_slots && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) { num_cpus = CPU_COUNT(&allowed); }
+    slots = (struct slot *)malloc(sizeof(struct slot) * num_slots);
+    for (i = 0; i < num_slots; i++) {
+        slots[i].node = NULL;
+        slots[i].cpu = NO_CPU;
+        if (num_cpus == 0) { continue; }
+
+        // The (i % num_cpus)th allowed CPU
+        int cpu, nth = i % num_cpus;
+        for (cpu = 0; !CPU_ISSET(cpu, &allowed) || nth-- > 0; cpu++) { }
+        slots[i].cpu = cpu;
+    }
+
+    for (i = 0; i < NUM_SCHED; i++) { initstats(&sched_stats[i]); }
+    initcaptures(&logs);
+    initcache(&cache, cache_dir);
+    initdeadlines(&deadlines, reject_late, kernel_deadlines);
+    initcgroups(&groups);
+    initpressure(&psi, psi_limit);
 
     // Initialize the queue with the given scheduling type
+    // Times are predicted from the history saved by the last run of the shell
     initqueue(&pid_list, sched_type);
-
-    // Set up signal handlers
-    signal(SIGCHLD, childdead);
-    signal(SIGTSTP, susp);
-    signal(SIGQUIT, cont);
+    if (slot_queues) { splitqueue(&pid_list, num_slots); }
+    char history[4096];
+    snprintf(history, sizeof(history), "%s/%s", getenv("HOME") != NULL ? getenv("HOME") : ".", PREDICT_FILE);
+    initpredictor(&bursts, PREDICT_ALPHA, history);
+    pid_list.predictor = &bursts;
+    // With one slot there is nothing to run alongside the critical path, the scheduler's order is kept
+    pid_list.critical = num_slots > 1;
+    initdag(&graph);
+
+    // Processes are reaped through their pidfds if the kernel has them
+    int self = pidfdopen(getpid());
+    use_pidfds = self != -1;
+    if (use_pidfds) { close(self); }
+
+    // Signals are read from a signalfd in the event loop instead of handled asynchronously
+    // Nothing that changes the queue ever runs in signal context
+    // SIGCHLD is blocked either way, it is only read if there are no pidfds to say what died
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTSTP);
+    sigaddset(&mask, SIGQUIT);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    if (use_pidfds) { sigdelset(&mask, SIGCHLD); }
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
     setpriority(PRIO_PROCESS, 0, -20);
 
+    // Everything the shell waits on goes through one epoll
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = signal_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+
+    // Only RR, SRTF, MLFQ and FAIR need to look at the running processes on a tick
+    // Otherwise the timer only goes off to retry jobs held back by pressure
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ev.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+    if (preemptive()) {
+        struct itimerspec timer;
+        timer.it_interval.tv_sec = 0;
+        timer.it_interval.tv_nsec = TICK_MS * 1000000;
+        timer.it_value = timer.it_interval;
+        timerfd_settime(timer_fd, 0, &timer, NULL);
+    }
+
+    // Running processes are sampled for top on a timer of their own
+    sample_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ev.data.fd = sample_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sample_fd, &ev);
+    struct itimerspec sampling;
+    sampling.it_interval.tv_sec = TOP_INTERVAL / 1000;
+    sampling.it_interval.tv_nsec = (TOP_INTERVAL % 1000) * 1000000;
+    sampling.it_value = sampling.it_interval;
+    timerfd_settime(sample_fd, 0, &sampling, NULL);
+
+    // Pick up whatever the last shell left in the journal
+    char journal_path[4096];
+    snprintf(journal_path, sizeof(journal_path), "%s/%s", getenv("HOME") != NULL ? getenv("HOME") : ".", JOURNAL_FILE);
+    initjournal(&journal, (journal_file != NULL) ? journal_file : journal_path);
+    if (journal.fd != -1) { recover(); }
+
+    // Take commands from other programs too
+    char control_path[4096];
+    snprintf(control_path, sizeof(control_path), "%s/%s", getenv("HOME") != NULL ? getenv("HOME") : ".", CONTROL_FILE);
+    initcontrol(&control, (control_file != NULL) ? control_file : control_path);
+    if (control.fd != -1) {
+        ev.data.fd = control.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, control.fd, &ev);
+    }
+
     // Print the shell version
     printf("\n"); // Formatting
     ver();
+    // Continue whatever was recovered from the journal
+    schedule();
 
-    while (run){
-        // If there is a process running and its in the foreground, pause the shell
-        // We don't want any input until a signal is recieved. This can be any signal
-        // but we are using SIGCHLD because it is the only one we are using
-        // Bascially block untill the process is done
-        while (io_occupied) { pause(); }
-
-        printf("\n=>");
-        for (arg_num = 0; (scanf("%s", input[arg_num])) == 1; arg_num++) {
-            if (getchar() == '\n') { break; }
-        }
-        printf("\n");   // Formatting
-
-        // In case we have a background then foreground process running
-        // Clears it to ensure we can't run anything with process is going
-        if (io_occupied) { continue; }
-
-        // Shows current verison of shell
-        if (strcmp(input[0], "ver") == 0 && arg_num == 0) { ver(); }
-        // Prints the list of commands
-        else if (strcmp(input[0], "help") == 0 && arg_num == 0) { help(); }
-        // Prints the help for a specific command
-        else if (strcmp(input[0], "help") == 0 && arg_num == 1) { helpcmd(input[arg_num]); }
-        // Prints the LIVING processes (should only ever be 1 or 2)
-        else if (strcmp(input[0], "ps") == 0 && arg_num == 0) { ps();}
-        // Kills a process with the given pid
-        else if (strcmp(input[0], "kill") == 0 && arg_num == 1) { mykill(atoi(input[1])); }
-        // Executes a process with the given parameters
-        else if (strcmp(input[0], "exec") == 0 && arg_num != 0) {
-            // First we will check if the exec is valid,
-            // If it is not, we will not execute that specific process
-            // We will just print an error message and continue to next input
-            for (i = 1; i <= arg_num; i++) { 
-                // Check if the format is valid
-                //      If it doesn't have a process name it is not valid
-                //      If it doesn't have a start or end parenthesis, it is invalid
-                // Will run the process if it is valid, otherwise print an error message
-                if (input[i][0] == '(' || strchr(input[i], '(') == NULL || input[i][strlen(input[i]) - 1] != ')') {
-                    printf("Invalid exec for arg %d. Type 'help exec' for help.\n\n", i);
-                    continue;
-                }
+    struct epoll_event events[MAX_EVENTS];
+    struct view line;
+    batch.r.fd = -1;
+    if (interactive) { opensource(&input, STDIN_FILENO); }
+    else {
+        // Nothing reads commands, so stdin is already at its end
+        input.r.fd = -1;
+        input.r.closed = 1;
+
+        int fd = (batch_file != NULL) ? open(batch_file, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+        if (fd < 0) {
+            printf("Unable to open %s\n", batch_file);
+            exit(EXIT_FAILURE);
+        }
+        startbatch(fd);
+    }
 
-                // If valid exec, run the process
-                else { exec(input[i]); }
+    while (run) {
+        // Take in as many batch jobs as there are slots for
+        admit();
+        finishbatch();
+
+        // Run whatever input is already buffered first, as long as no foreground process is running
+        while (interactive && accepting() && readline(&input.r, &line)) { command(line); }
+        if (!run) { break; }
+
+        // Once stdin is closed there is nothing left to do but wait for the queue and batch to empty
+        // and for the clients of the control socket to hang up
+        if (input.r.closed && !buffered(&input.r) && !batchrunning() && isempty(&pid_list) && control.count == 0) { break; }
+
+        if (interactive && accepting() && !input.r.closed) { prompt(); }
+        if (interactive) { watch(&input, accepting() && !input.r.closed); }
+        if (batchrunning()) { watch(&batch, !batch.r.closed && pid_list.size < num_slots); }
+
+        // A file is always ready, so just check for events and read it
+        // Batch files are read by admit() as they are needed
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, (input.watching && input.is_file) ? 0 : -1);
+        int reaped = 0;
+        if (input.watching && input.is_file) { readmore(&input); }
+        for (i = 0; i < n; i++) {
+            if (events[i].data.fd == signal_fd) { handlesignals(); }
+            else if (events[i].data.fd == timer_fd) { tick(); }
+            else if (events[i].data.fd == sample_fd) {
+                uint64_t expirations;
+                if (read(sample_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) { sampleslots(0); }
+            }
+            else if (batch.r.fd != -1 && events[i].data.fd == batch.r.fd) { readmore(&batch); }
+            else if (events[i].data.fd == STDIN_FILENO) { readmore(&input); }
+            else if (capturefd(events[i].data.fd, &logs) != NULL) {
+                drain(capturefd(events[i].data.fd, &logs), &logs);
+                trimlogs(&logs);
             }
+            else if (iswatched(events[i].data.fd)) { reaped += reap(watched[events[i].data.fd]); }
+            else if (events[i].data.fd == control.fd) { acceptclients(&control, epoll_fd); }
+            else if (isclient(events[i].data.fd, &control)) { serve(events[i].data.fd); }
+        }
+
+        // Everything the clients submitted in this round is scheduled together
+        if (requested && run) {
+            requested = 0;
+            schedule();
+        }
 
-            // All processes have been added to the queue, run the first one
-            // When the process finishes, the next one will take its place
-            // No need to try to run each process individually - one call will suffice
-            runprocess();
+        // Run the next processes once for everything that died together
+        if (reaped != 0 && peek(&pid_list) != NULL && run) {
+            printf("\n"); // Formatting
+            schedule();
         }
-        // Exits the shell
-        else if (strcmp(input[0], "exit") == 0 && arg_num == 0) { myexit(); }
-        // If the command is not recognized, print an error message
-        else { printf("No such command. Check help for help.\n"); }
     }
+
+    // Keep what we learned about each program for next time
+    savepredictor(&bursts);
+    // The logs and groups only last as long as the shell
+    removecaptures(&logs);
+    removecgroups(&groups);
+    // What is still live in the journal is left for the next shell
+    closejournal(&journal);
+    closecontrol(&control);
     
+    // Without anyone watching, the exit status is all that says how the batch went
+    if (!interactive && (jobs_failed != 0 || batch_invalid != 0)) { exit(EXIT_FAILURE); }
     exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+}
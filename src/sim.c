@@ -0,0 +1,496 @@
+// Discrete-event simulator for the schedulers in queue.h
+// Replays a workload against the same queue the shell uses, on a simulated clock instead of forking
+// Slots, preemption and burst prediction work like they do in shell.c, so the results carry over
+// Every job is a p(n,qt) whose n * qt covers its burst, that is all the queue gets to predict from
+
+// Usage: sim [FCFS|SJF|RR|SRTF|MLFQ|FAIR|EDF ...] [-j N] [-q ms] [-o] [-d slack] [-s seed] [trace | -n jobs [-r rate] [-b ms] [-a alpha] [-k programs]]
+//      FCFS/SJF/RR/SRTF/MLFQ/FAIR/EDF - schedulers to compare on the same workload, all of them if none are given
+//      -j N        - number of slots, 1 if not given
+//      -q ms       - qt of every job, the RR quantum, DEFAULT_QUANTUM if not given
+//      -o          - don't learn from past runs, predict from n * qt alone
+//      -d slack    - every job is due slack times its burst after it arrives, at least 1, no deadlines if not given
+//      -s seed     - seed of the synthetic workload, 1 if not given
+//      trace       - file of "arrival burst program" lines in msec, sorted by arrival, # for comments
+//      -n jobs     - number of synthetic jobs, 100000 if there is no trace
+//      -r rate     - Poisson arrivals, jobs/sec, 50 if not given
+//      -b ms       - mean burst, 10 if not given
+//      -a alpha    - Pareto shape of the mean burst of each program, exponential if 0, 1.5 if not given
+//      -k programs - number of distinct programs, 16 if not given
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include "queue.h"
+#include "stats.h"
+
+// Longest program name a synthetic job gets
+#define NAME_MAX_LEN 32
+
+// One job of the workload
+struct job {
+    long arrival;
+    int burst;
+    // Points into the trace buffer or at one of the synthetic names
+    struct view program;
+};
+
+// Where the jobs come from, a trace file or a generator
+struct workload {
+    // Trace file, reader.fd is -1 for a synthetic workload
+    struct reader trace;
+    long line;
+    long last_arrival;
+
+    // Synthetic workload, the same seed always gives the same jobs
+    long jobs;
+    long made;
+    double rate;
+    double mean;
+    double alpha;
+    int programs;
+    unsigned long seed;
+    unsigned long rng;
+    double clock;
+    char (*names)[NAME_MAX_LEN];
+    double *program_mean;
+};
+
+// Slot a job runs in, it finishes at started + left unless it is preempted first
+struct slot {
+    struct node *node;
+    long left;
+};
+
+// Type of scheduling and quantum of the run
+int sched_type;
+int quantum = DEFAULT_QUANTUM;
+
+// Slots and how many of them are taken
+struct slot *slots;
+int num_slots = 1;
+int num_running = 0;
+
+// Queue, burst history and accounting of the scheduler being simulated
+struct queue jobs;
+struct predictor bursts;
+struct stats sim_stats;
+int oracle = 0;
+// How many times its burst a job has to be done in, 0 for no deadlines
+double slack = 0;
+
+// Pids handed out to jobs as they start, no process is ever made
+int next_pid = 1;
+
+// Slowdown (turnaround / burst) of each job, summed for the fairness index
+double slowdown_sum, slowdown_sq, slowdown_max;
+
+// Times a slot was given to a job and a job was preempted, and what deciding cost in nsec
+long decisions, preemptions;
+// Time in msec the MLFQ levels were last boosted
+long last_boost;
+double decision_ns;
+
+
+// Current time in nsec, only used to measure the scheduler itself
+double nanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+// Uniform random number in (0, 1], xorshift64* so every platform gives the same workload
+double uniform(struct workload *w) {
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    return ((w->rng * 2685821657736338717UL) >> 11) / 9007199254740992.0 + 1 / 9007199254740992.0;
+}
+
+// Exponentially distributed number with the given mean
+double exponential(double mean, struct workload *w) {
+    return -mean * log(uniform(w));
+}
+
+// Pareto distributed number with the given mean and shape, heavy tailed for shapes close to 1
+double pareto(double mean, double alpha, struct workload *w) {
+    double scale = mean * (alpha - 1) / alpha;
+    return scale / pow(uniform(w), 1 / alpha);
+}
+
+
+// Starts a workload over from its first job
+void rewindworkload(struct workload *w) {
+    w->line = 0;
+    w->last_arrival = 0;
+
+    if (w->trace.fd != -1) {
+        lseek(w->trace.fd, 0, SEEK_SET);
+        w->trace.start = 0;
+        w->trace.end = 0;
+        w->trace.closed = 0;
+        return;
+    }
+
+    // Each program gets its own mean burst, so there is history worth learning
+    w->made = 0;
+    w->clock = 0;
+    w->rng = w->seed * 0x9E3779B97F4A7C15UL + 1;
+    for (int i = 0; i < w->programs; i++) {
+        w->program_mean[i] = (w->alpha > 1) ? pareto(w->mean, w->alpha, w) : exponential(w->mean, w);
+    }
+}
+
+// Takes the next line of the trace as a job, returns 0 once the trace is done
+// Invalid lines are skipped with a warning
+int tracejob(struct workload *w, struct job *j) {
+    struct view line, arrival, burst;
+
+    while (1) {
+        if (!readline(&w->trace, &line)) {
+            if (w->trace.closed) { return 0; }
+            fill(&w->trace);
+            continue;
+        }
+        w->line++;
+
+        if (!nextword(&line, &arrival) || arrival.s[0] == '#') { continue; }
+        if (!nextword(&line, &burst) || !nextword(&line, &j->program) || viewint(burst) <= 0) {
+            printf("Invalid job on line %ld of the trace\n", w->line);
+            continue;
+        }
+
+        j->arrival = viewint(arrival);
+        j->burst = viewint(burst);
+        // Out of order jobs arrive as soon as they can
+        if (j->arrival < w->last_arrival) { j->arrival = w->last_arrival; }
+        w->last_arrival = j->arrival;
+        return 1;
+    }
+}
+
+// Makes the next synthetic job, returns 0 once all of them are made
+int syntheticjob(struct workload *w, struct job *j) {
+    if (w->made == w->jobs) { return 0; }
+    w->made++;
+
+    // Poisson arrivals are exponentially spaced
+    w->clock += exponential(1000 / w->rate, w);
+    int program = (int)(uniform(w) * w->programs) % w->programs;
+
+    j->arrival = (long)w->clock;
+    j->burst = (int)(exponential(w->program_mean[program], w) + 0.5);
+    if (j->burst < 1) { j->burst = 1; }
+    j->program.s = w->names[program];
+    j->program.len = strlen(w->names[program]);
+    return 1;
+}
+
+// Next job of the workload, 0 if there are none left
+int nextjob(struct workload *w, struct job *j) {
+    return (w->trace.fd != -1) ? tracejob(w, j) : syntheticjob(w, j);
+}
+
+
+// Actual burst of a job, packed after its p(n,qt) args where the queue never looks
+int burstof(struct node *n) {
+    return atoi(n->args[3]);
+}
+
+// Enqueues a job as p(n,qt) plus its burst
+struct node *submit(struct job *j) {
+    char n[16], qt[16], burst[16];
+    struct view args[4];
+
+    args[0] = j->program;
+    args[1].s = n;
+    args[1].len = snprintf(n, sizeof(n), "%d", (j->burst + quantum - 1) / quantum);
+    args[2].s = qt;
+    args[2].len = snprintf(qt, sizeof(qt), "%d", quantum);
+    args[3].s = burst;
+    args[3].len = snprintf(burst, sizeof(burst), "%d", j->burst);
+
+    struct node *curr_node = enqueue(args, 4, &jobs);
+    curr_node->arrived = j->arrival;
+    // It was queued with no deadline, EDF moves it up once it has one
+    if (slack != 0) { setdeadline(curr_node, j->arrival + (long)(slack * j->burst), &jobs); }
+    return curr_node;
+}
+
+
+// Gives a slot to the job at the top of the queue, like startprocess/resumeprocess in the shell
+void startjob(struct node *curr_node, int slot, long time) {
+    if (curr_node->pid == NO_PID) {
+        setpid(curr_node, next_pid++, &jobs);
+        curr_node->first_started = time;
+    }
+
+    slots[slot].node = curr_node;
+    slots[slot].left = burstof(curr_node) - curr_node->ran;
+    curr_node->worker = slot;
+    curr_node->started = time;
+    num_running++;
+    decisions++;
+}
+
+// Takes the job out of its slot and puts it back in the queue with what is left of its estimate
+void preempt(int slot, long time) {
+    struct node *curr_node = slots[slot].node;
+
+    curr_node->ran += time - curr_node->started;
+    curr_node->time -= time - curr_node->started;
+    if (curr_node->time < 0) { curr_node->time = 0; }
+
+    // MLFQ, it drops a level if it used up its quantum, not if it was pushed out by a higher level
+    int slice = timeslice(curr_node, &jobs);
+    if (slice != 0 && time - curr_node->started >= slice) { demote(curr_node, &jobs); }
+
+    slots[slot].node = NULL;
+    curr_node->worker = NO_SLOT;
+    num_running--;
+    preemptions++;
+
+    requeue(curr_node, &jobs);
+    charge(curr_node, time - curr_node->started, &jobs);
+}
+
+// Finishes the job in a slot, accounting for it and learning its burst
+void finishjob(int slot, long time) {
+    struct node *curr_node = slots[slot].node;
+
+    curr_node->ran += time - curr_node->started;
+    curr_node->finished = time;
+    charge(curr_node, time - curr_node->started, &jobs);
+    if (jobs.predictor != NULL) { record(curr_node->name, curr_node->ran, &bursts); }
+
+    addsample(&sim_stats, curr_node->arrived, curr_node->first_started, time, curr_node->ran, curr_node->ran, 0);
+    if (curr_node->deadline != 0) { adddeadline(&sim_stats, time - curr_node->deadline); }
+    double slowdown = (double)(time - curr_node->arrived) / curr_node->ran;
+    slowdown_sum += slowdown;
+    slowdown_sq += slowdown * slowdown;
+    if (slowdown > slowdown_max) { slowdown_max = slowdown; }
+
+    slots[slot].node = NULL;
+    num_running--;
+    delete(curr_node->pid, &jobs);
+}
+
+
+// Fills every free slot with the top of the queue
+void runjobs(long time) {
+    for (int i = 0; i < num_slots && peek(&jobs) != NULL; i++) {
+        if (slots[i].node == NULL) { startjob(pop(&jobs), i, time); }
+    }
+}
+
+// Same decisions as schedule() in the shell, made at an exact time instead of on a tick
+void schedule(long time) {
+    int i;
+
+    // MLFQ, every MLFQ_BOOST msec everything goes back to the top level, running or not
+    if (sched_type == MLFQ && time - last_boost >= MLFQ_BOOST) {
+        boost(&jobs);
+        for (i = 0; i < num_slots; i++) {
+            if (slots[i].node != NULL) { slots[i].node->level = 0; }
+        }
+        last_boost = time - (time - last_boost) % MLFQ_BOOST;
+    }
+
+    // RR/MLFQ, stop every job that has used up its quantum if something is waiting for it
+    for (i = 0; i < num_slots && peek(&jobs) != NULL; i++) {
+        if (slots[i].node == NULL) { continue; }
+
+        int slice = timeslice(slots[i].node, &jobs);
+        if (slice != 0 && time - slots[i].node->started >= slice) { preempt(i, time); }
+    }
+    runjobs(time);
+
+    // SRTF, while the shortest waiting job has less left than the longest running one, swap them
+    // MLFQ, the same with the highest waiting level against the lowest running one
+    // EDF, the same with the waiting job due first against the running one due last
+    while (peek(&jobs) != NULL && num_running == num_slots) {
+        int worst = 0;
+        long curr_rank, worst_rank = 0;
+        for (i = 0; i < num_slots; i++) {
+            curr_rank = rank(slots[i].node, time - slots[i].node->started, &jobs);
+            if (i == 0 || curr_rank > worst_rank) {
+                worst = i;
+                worst_rank = curr_rank;
+            }
+        }
+
+        if (!preempts(peek(&jobs), worst_rank, &jobs)) { break; }
+        preempt(worst, time);
+        runjobs(time);
+    }
+}
+
+// Time of the next thing a slot does, finishing or running out of its quantum
+long slotevent(int slot) {
+    struct node *curr_node = slots[slot].node;
+    long end = curr_node->started + slots[slot].left;
+
+    // The quantum only matters if something is waiting to take over
+    int slice = timeslice(curr_node, &jobs);
+    if (slice != 0 && peek(&jobs) != NULL && curr_node->started + slice < end) { end = curr_node->started + slice; }
+    return end;
+}
+
+
+// Runs the whole workload through one scheduler
+void simulate(int type, struct workload *w) {
+    struct job j;
+    long clock = 0;
+    int i;
+
+    sched_type = type;
+    initqueue(&jobs, sched_type);
+    initpredictor(&bursts, PREDICT_ALPHA, NULL);
+    jobs.predictor = oracle ? NULL : &bursts;
+    initstats(&sim_stats);
+    for (i = 0; i < num_slots; i++) { slots[i].node = NULL; }
+    num_running = 0;
+    slowdown_sum = slowdown_sq = slowdown_max = 0;
+    decisions = preemptions = 0;
+    last_boost = 0;
+    next_pid = 1;
+    decision_ns = 0;
+
+    rewindworkload(w);
+    int more = nextjob(w, &j);
+
+    while (more || !isempty(&jobs)) {
+        // Jump to whatever happens next, an arrival or a slot finishing or running out of its quantum
+        long next = more ? j.arrival : LONG_MAX;
+        for (i = 0; i < num_slots; i++) {
+            if (slots[i].node != NULL && slotevent(i) < next) { next = slotevent(i); }
+        }
+        // MLFQ, the boost only matters if something is waiting below the top
+        if (sched_type == MLFQ && peek(&jobs) != NULL && last_boost + MLFQ_BOOST < next) { next = last_boost + MLFQ_BOOST; }
+        if (next > clock) { clock = next; }
+
+        // Only the queue and the scheduler are timed, not making up the workload
+        double start = nanos();
+        for (i = 0; i < num_slots; i++) {
+            if (slots[i].node != NULL && slots[i].node->started + slots[i].left <= clock) { finishjob(i, clock); }
+        }
+        decision_ns += nanos() - start;
+
+        while (more && j.arrival <= clock) {
+            start = nanos();
+            submit(&j);
+            decision_ns += nanos() - start;
+            more = nextjob(w, &j);
+        }
+
+        start = nanos();
+        schedule(clock);
+        decision_ns += nanos() - start;
+    }
+}
+
+// Prints how the last simulated scheduler did
+void report() {
+    printstats(sched_names[sched_type], &sim_stats);
+    if (sim_stats.count == 0) { return; }
+
+    // Jain's index, 1 when every job is slowed down the same, 1/n when one job takes all of it
+    double fairness = slowdown_sum * slowdown_sum / (sim_stats.count * slowdown_sq);
+    printf("\tSlowdown     mean %10.2f   max %10.1f   fairness %.3f\n", slowdown_sum / sim_stats.count, slowdown_max, fairness);
+    printf("\tDecisions    %ld, %ld preemptions, %.0f ns each\n", decisions, preemptions, decisions ? decision_ns / decisions : 0);
+}
+
+
+int main(int argc, char **argv) {
+    struct workload w;
+    int types[NUM_SCHED], num_types = 0, i;
+    char *trace = NULL;
+
+    w.jobs = 100000;
+    w.rate = 50;
+    w.mean = 10;
+    w.alpha = 1.5;
+    w.programs = 16;
+    w.seed = 1;
+
+    for (i = 1; i < argc; i++) {
+        int type;
+        for (type = 0; type < NUM_SCHED && strcmp(argv[i], sched_names[type]) != 0; type++) { }
+
+        if (type < NUM_SCHED && num_types < NUM_SCHED) { types[num_types++] = type; }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) { num_slots = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) { quantum = atoi(argv[++i]); }
+        else if (strcmp(argv[i], "-o") == 0) { oracle = 1; }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) { slack = atof(argv[++i]); }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) { w.seed = strtoul(argv[++i], NULL, 10); }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) { w.jobs = atol(argv[++i]); }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) { w.rate = atof(argv[++i]); }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) { w.mean = atof(argv[++i]); }
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) { w.alpha = atof(argv[++i]); }
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) { w.programs = atoi(argv[++i]); }
+        else if (argv[i][0] != '-' && trace == NULL) { trace = argv[i]; }
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (num_slots <= 0 || quantum <= 0 || w.rate <= 0 || w.mean <= 0 || w.programs <= 0) {
+        printf("Slots, quantum, rate, mean burst and programs must all be positive\n");
+        exit(EXIT_FAILURE);
+    }
+    // A job due sooner than its burst could never make it
+    if (slack != 0 && slack < 1) {
+        printf("Slack must be at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Compare every scheduler if none were asked for
+    if (num_types == 0) {
+        for (i = 0; i < NUM_SCHED; i++) { types[num_types++] = i; }
+    }
+
+    w.trace.fd = -1;
+    if (trace != NULL) {
+        int fd = open(trace, O_RDONLY);
+        if (fd < 0) {
+            printf("Unable to open %s\n", trace);
+            exit(EXIT_FAILURE);
+        }
+        initreader(&w.trace, fd);
+        printf("Replaying %s", trace);
+    }
+    else {
+        w.names = (char (*)[NAME_MAX_LEN])malloc(NAME_MAX_LEN * w.programs);
+        w.program_mean = (double *)malloc(sizeof(double) * w.programs);
+        for (i = 0; i < w.programs; i++) { snprintf(w.names[i], NAME_MAX_LEN, "prog%d", i); }
+        printf("Simulating %ld jobs of %d programs, %.1f jobs/sec, %.1f ms mean burst", w.jobs, w.programs, w.rate, w.mean);
+        if (w.alpha > 1) { printf(" (Pareto %.2f)", w.alpha); }
+    }
+    printf(" on %d slot(s), quantum %d ms%s", num_slots, quantum, oracle ? ", no burst history" : "");
+    if (slack != 0) { printf(", due %.1fx their burst after arriving", slack); }
+    printf("\n\n");
+
+    slots = (struct slot *)malloc(sizeof(struct slot) * num_slots);
+    for (i = 0; i < num_types; i++) {
+        simulate(types[i], &w);
+        report();
+        printf("\n");
+
+        free(sim_stats.wait);
+        free(sim_stats.turnaround);
+        free(sim_stats.response);
+        free(sim_stats.lateness);
+        free(jobs.rq[0].heap);
+        free(jobs.rq);
+        free(jobs.index);
+    }
+
+    exit(EXIT_SUCCESS);
+}
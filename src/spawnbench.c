@@ -0,0 +1,81 @@
+// Microbenchmark for the launchers in launch.h
+// Starts the same program over and over with each launcher and reports jobs launched per second
+// Can hold some memory resident first, like a shell with a large queue, since that is what makes fork slow
+
+// Usage: spawnbench program [jobs] [resident MB]
+//      program     - executable to launch, run as p(0,0,&) so p-shell exits right away
+//      jobs        - number of launches per launcher, 2000 if not given
+//      resident MB - memory to touch before launching, 0 if not given
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "launch.h"
+
+// Most children alive at once, so we measure launching and not running out of pids
+#define BATCH 64
+
+
+// Current time in sec
+double seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s program [jobs] [resident MB]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    int jobs = (argc > 2) ? atoi(argv[2]) : 2000;
+    long resident = (argc > 3) ? atol(argv[3]) : 0;
+
+    // Touch every page so it really is resident, and fork has to copy its page tables
+    char *memory = NULL;
+    if (resident > 0) {
+        memory = (char *)malloc(resident * 1024 * 1024);
+        memset(memory, 1, resident * 1024 * 1024);
+    }
+
+    // Same arguments the shell would give p(0,0,&)
+    char *args[] = { argv[1], "0", "0", "&", NULL };
+
+    printf("Launching %s %d times per launcher, %ld MB resident\n", argv[1], jobs, resident);
+    printf("\tLAUNCHER\tJOBS/SEC\n");
+
+    for (int how = 0; how < NUM_LAUNCHERS; how++) {
+        int launched = 0, failed = 0, alive = 0;
+        double start = seconds();
+
+        while (launched + failed < jobs) {
+            if (launch(how, argv[1], args, 1, NO_CPU, NULL, -1, NULL) < 0) { failed++; }
+            else {
+                launched++;
+                alive++;
+            }
+
+            // Reap a batch at a time
+            if (alive == BATCH) {
+                while (alive > 0 && wait(NULL) > 0) { alive--; }
+            }
+        }
+        while (alive > 0 && wait(NULL) > 0) { alive--; }
+
+        double elapsed = seconds() - start;
+        printf("\t%s\t\t%.0f", launch_names[how], launched / elapsed);
+        if (failed != 0) { printf("\t(%d failed)", failed); }
+        printf("\n");
+    }
+
+    free(memory);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,133 @@
+// Per job accounting, kept per scheduler so they can be compared
+// Every finished job adds its waiting and turnaround time, CPU time and max RSS
+//      turnaround = finished - arrived
+//      waiting    = turnaround - time it held a slot
+//      response   = first started - arrived
+// A job with a deadline also adds how late it finished, lateness = finished - deadline, negative if it was early
+// Percentiles are found by sorting a copy when they are asked for, not on every job
+
+// Starting number of samples, doubles when full
+#define STATS_INIT 256
+
+// Accounting for every job finished under one scheduler
+struct stats {
+    // Waiting, turnaround and response time of each job in msec
+    double *wait;
+    double *turnaround;
+    double *response;
+    long count;
+    long cap;
+
+    // Total CPU time of the jobs in msec, and the most memory any of them used in KB
+    double cpu;
+    long maxrss;
+
+    // First arrival and last finish in msec, throughput is measured between them
+    long first_arrival;
+    long last_finish;
+
+    // Lateness in msec of each job that had a deadline, and how many missed it, NULL until the first one
+    double *lateness;
+    long deadlines;
+    long deadline_cap;
+    long missed;
+};
+
+
+// Initialize empty stats
+void initstats(struct stats *s) {
+    s->cap = STATS_INIT;
+    s->count = 0;
+    s->wait = (double *)malloc(sizeof(double) * s->cap);
+    s->turnaround = (double *)malloc(sizeof(double) * s->cap);
+    s->response = (double *)malloc(sizeof(double) * s->cap);
+    s->cpu = 0;
+    s->maxrss = 0;
+    s->first_arrival = 0;
+    s->last_finish = 0;
+    s->lateness = NULL;
+    s->deadlines = s->deadline_cap = s->missed = 0;
+}
+
+// Adds a finished job
+// started is -1 if it was killed before it ever ran
+void addsample(struct stats *s, long arrived, long started, long finished, long ran, double cpu, long maxrss) {
+    if (s->count == s->cap) {
+        s->cap *= 2;
+        s->wait = (double *)realloc(s->wait, sizeof(double) * s->cap);
+        s->turnaround = (double *)realloc(s->turnaround, sizeof(double) * s->cap);
+        s->response = (double *)realloc(s->response, sizeof(double) * s->cap);
+    }
+
+    double turnaround = finished - arrived;
+    double wait = turnaround - ran;
+    s->turnaround[s->count] = turnaround;
+    s->wait[s->count] = (wait > 0) ? wait : 0;
+    s->response[s->count] = (started >= 0) ? started - arrived : turnaround;
+
+    if (s->count == 0 || arrived < s->first_arrival) { s->first_arrival = arrived; }
+    if (s->count == 0 || finished > s->last_finish) { s->last_finish = finished; }
+    s->count++;
+
+    s->cpu += cpu;
+    if (maxrss > s->maxrss) { s->maxrss = maxrss; }
+}
+
+// Adds how late a finished job with a deadline was, in msec
+void adddeadline(struct stats *s, long lateness) {
+    if (s->deadlines == s->deadline_cap) {
+        s->deadline_cap = (s->deadline_cap == 0) ? STATS_INIT : s->deadline_cap * 2;
+        s->lateness = (double *)realloc(s->lateness, sizeof(double) * s->deadline_cap);
+    }
+    s->lateness[s->deadlines++] = lateness;
+    if (lateness > 0) { s->missed++; }
+}
+
+
+// Comparison of doubles for qsort
+int cmpdouble(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Prints the mean, p50 and p99 of n values, sorting them in place
+void printdist(const char *label, double *v, long n) {
+    double sum = 0;
+    for (long i = 0; i < n; i++) { sum += v[i]; }
+    qsort(v, n, sizeof(double), cmpdouble);
+
+    printf("\t%-12s mean %10.1f   p50 %10.1f   p99 %10.1f\n", label, sum / n, v[n / 2], v[(n * 99) / 100]);
+}
+
+// Prints the stats of one scheduler, nothing if no job has finished under it
+void printstats(const char *name, struct stats *s) {
+    if (s->count == 0) { return; }
+
+    double span = (s->last_finish - s->first_arrival) / 1000.0;
+    printf("Scheduler %s: %ld jobs", name, s->count);
+    if (span > 0) { printf(", %.1f jobs/sec", s->count / span); }
+    printf("\n");
+
+    // Sort copies, the samples stay in the order the jobs finished
+    double *sorted = (double *)malloc(sizeof(double) * s->count);
+    memcpy(sorted, s->wait, sizeof(double) * s->count);
+    printdist("Wait (ms)", sorted, s->count);
+    memcpy(sorted, s->turnaround, sizeof(double) * s->count);
+    printdist("Turnaround", sorted, s->count);
+    memcpy(sorted, s->response, sizeof(double) * s->count);
+    printdist("Response", sorted, s->count);
+    free(sorted);
+
+    if (s->deadlines != 0) {
+        printf("\tDeadlines    %ld jobs had one, %ld missed it (%.1f%%)\n", s->deadlines, s->missed, 100.0 * s->missed / s->deadlines);
+        sorted = (double *)malloc(sizeof(double) * s->deadlines);
+        memcpy(sorted, s->lateness, sizeof(double) * s->deadlines);
+        printdist("Lateness", sorted, s->deadlines);
+        free(sorted);
+    }
+
+    printf("\tCPU time %.1f ms total, %.1f ms per job", s->cpu, s->cpu / s->count);
+    // Nothing real ran if no memory was used, like in the simulator
+    if (s->maxrss != 0) { printf(", max RSS %ld KB", s->maxrss); }
+    printf("\n");
+}
@@ -0,0 +1,94 @@
+// Sampling of what the running jobs are doing, for top
+// Every TOP_INTERVAL msec each stage of every job in a slot has its /proc/<pid>/stat and statm read
+// The files are opened once per process and read again with pread, so a sample is two reads and no opens
+// CPU% is worked out from the ticks used since the sample before, which is kept with the process
+// Only the jobs in slots are read, so the cost of a round is the same however long the queue is
+
+// Msec between samples
+#define TOP_INTERVAL 1000
+
+// Last sample of one process
+struct sample {
+    // /proc/<pid>/stat and statm, kept open as long as the process is alive
+    int stat_fd;
+    int statm_fd;
+
+    // Clock ticks of CPU it had used, and the time in msec, when it was sampled
+    unsigned long long ticks;
+    long time;
+
+    // What it was doing, R, S, D, T and so on from stat
+    char state;
+    // Percent of one CPU it used since the sample before
+    double cpu;
+    // Resident memory in KB
+    long rss;
+};
+
+
+// Opens the /proc files of a process to sample it, NULL if it is already gone
+struct sample *opensample(int pid) {
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    int stat_fd = open(path, O_RDONLY | O_CLOEXEC);
+    snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+    int statm_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (stat_fd < 0 || statm_fd < 0) {
+        if (stat_fd >= 0) { close(stat_fd); }
+        if (statm_fd >= 0) { close(statm_fd); }
+        return NULL;
+    }
+
+    struct sample *s = (struct sample *)calloc(1, sizeof(struct sample));
+    s->stat_fd = stat_fd;
+    s->statm_fd = statm_fd;
+    s->state = '?';
+    return s;
+}
+
+// Closes the files of a sample and frees it
+void closesample(struct sample *s) {
+    if (s == NULL) { return; }
+    close(s->stat_fd);
+    close(s->statm_fd);
+    free(s);
+}
+
+// Reads the process again, CPU% is over the time since the last sample
+// The first sample goes back to when the process started, at started msec
+// Returns 0 if the process is gone
+int takesample(struct sample *s, long time, long started) {
+    char buf[1024];
+
+    ssize_t n = pread(s->stat_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) { return 0; }
+    buf[n] = '\0';
+
+    // The name is in parentheses and may have anything in it, the fields start after the last )
+    char *fields = strrchr(buf, ')');
+    unsigned long long utime, stime;
+    char state;
+    if (fields == NULL || sscanf(fields + 1, " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &state, &utime, &stime) != 3) { return 0; }
+
+    // Size and resident, in pages
+    long size, resident;
+    n = pread(s->statm_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) { return 0; }
+    buf[n] = '\0';
+    if (sscanf(buf, "%ld %ld", &size, &resident) != 2) { return 0; }
+
+    long since = (s->time != 0) ? s->time : started;
+    unsigned long long ticks = utime + stime;
+    if (time > since) { s->cpu = (ticks - s->ticks) * 1000.0 / sysconf(_SC_CLK_TCK) / (time - since) * 100; }
+    s->ticks = ticks;
+    s->time = time;
+    s->state = state;
+    s->rss = resident * (sysconf(_SC_PAGESIZE) / 1024);
+    return 1;
+}
+
+// CPU time in sec the process had used at its last sample
+double cputime(struct sample *s) {
+    return (double)s->ticks / sysconf(_SC_CLK_TCK);
+}
@@ -0,0 +1,154 @@
+// Tracing of what the scheduler does, for trace start|stop|dump file
+// Every event is a fixed size record put into a ring in memory, the oldest ones are written over once it is full
+//      A record is a clock read and a few stores, nothing is formatted or written until the ring is dumped
+//      With tracing off an event is one test of a flag
+// A dump is Chrome trace event JSON, it opens in Perfetto or chrome://tracing
+//      Each slot is a thread, a job is a span on it from when it is dispatched to when it is preempted or exits
+//      The rest are instants, and the number of waiting jobs is a counter
+
+// Records kept, a power of 2
+#define TRACE_EVENTS (1 << 16)
+// Bytes of a program's name kept with each record, its last ones
+#define TRACE_NAME 16
+
+// Kinds of events
+#define TRACE_ENQUEUE 0
+#define TRACE_DISPATCH 1
+#define TRACE_RESUME 2
+#define TRACE_PREEMPT 3
+#define TRACE_EXIT 4
+#define TRACE_REAP 5
+#define TRACE_KILL 6
+#define TRACE_STOP 7
+#define TRACE_CONT 8
+#define NUM_TRACE 9
+
+const char *trace_names[NUM_TRACE] = { "enqueue", "dispatch", "resume", "preempt", "exit", "reap", "kill", "stop", "continue" };
+// What the arg of each kind of event is
+const char *trace_args[NUM_TRACE] = { "waiting", "waiting", "waiting", "ran_ms", "ran_ms", "status", "signal", "running", "running" };
+
+// One event
+struct event {
+    // Nsec since tracing started
+    uint64_t ns;
+    int32_t pid;
+    // Jobs waiting, msec run, wait status, signal or jobs running, see trace_args
+    int32_t arg;
+    int16_t type;
+    int16_t slot;
+    char name[TRACE_NAME];
+};
+
+// Ring of the last TRACE_EVENTS events
+struct tracer {
+    struct event *ring;
+    // Events ever recorded since the last start, the next one goes at head % TRACE_EVENTS
+    unsigned long head;
+    // Recording or not, the ring is kept when it stops so it can still be dumped
+    int on;
+    // CLOCK_MONOTONIC in nsec when tracing started
+    uint64_t since;
+};
+
+
+// Monotonic clock in nsec
+uint64_t tracens() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Starts recording into an empty ring, made the first time
+void starttrace(struct tracer *t) {
+    if (t->ring == NULL) { t->ring = (struct event *)malloc(sizeof(struct event) * TRACE_EVENTS); }
+    t->head = 0;
+    t->since = tracens();
+    t->on = 1;
+}
+
+// Records an event of a process, in a slot or NO_SLOT
+void trace(int type, int pid, const char *name, int slot, long arg, struct tracer *t) {
+    if (!t->on) { return; }
+
+    struct event *e = &t->ring[t->head++ & (TRACE_EVENTS - 1)];
+    e->ns = tracens() - t->since;
+    e->pid = pid;
+    e->arg = arg;
+    e->type = type;
+    e->slot = slot;
+    // The end of the name is kept, that is where the program is, the rest of the path is dropped when it is dumped
+    if (name == NULL) { name = ""; }
+    size_t len = strlen(name), keep = (len < TRACE_NAME) ? len : TRACE_NAME - 1;
+    memcpy(e->name, name + len - keep, keep);
+    e->name[keep] = '\0';
+}
+
+// Events in the ring, and how many older ones were written over
+unsigned long traced(struct tracer *t) {
+    return (t->head < TRACE_EVENTS) ? t->head : TRACE_EVENTS;
+}
+unsigned long dropped(struct tracer *t) {
+    return t->head - traced(t);
+}
+
+// Writes the program of a name as a JSON string, without its path, it may have anything in it
+void jsonname(FILE *f, const char *name) {
+    const char *base = strrchr(name, '/');
+    if (base != NULL) { name = base + 1; }
+
+    fputc('"', f);
+    for (int i = 0; name[i] != '\0'; i++) {
+        unsigned char c = name[i];
+        if (c == '"' || c == '\\') { fprintf(f, "\\%c", c); }
+        else if (c < 0x20 || c >= 0x7f) { fprintf(f, "\\u%04x", c); }
+        else { fputc(c, f); }
+    }
+    fputc('"', f);
+}
+
+// Writes the ring to f as Chrome trace event JSON, oldest event first
+// Slot i is thread i + 1 of the shell, thread 0 is the queue
+// A span whose start was written over has its end left out, one still open is closed by the viewer
+void dumptrace(FILE *f, int num_slots, struct tracer *t) {
+    char *spans = (char *)calloc(num_slots, 1);
+    unsigned long count = traced(t);
+    int pid = getpid();
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%lu},\"traceEvents\":[\n", dropped(t));
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"shell\"}},\n", pid);
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"queue\"}}", pid);
+    for (int i = 0; i < num_slots; i++) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"slot %d\"}}", pid, i + 1, i);
+    }
+
+    for (unsigned long i = t->head - count; i != t->head; i++) {
+        struct event *e = &t->ring[i & (TRACE_EVENTS - 1)];
+        int tid = (e->slot >= 0 && e->slot < num_slots) ? e->slot + 1 : 0;
+        unsigned long long us = e->ns / 1000, frac = e->ns % 1000;
+
+        // A span ends on the slot it started on, and only if its start is still in the ring
+        if (e->type == TRACE_PREEMPT || e->type == TRACE_EXIT) {
+            if (tid == 0 || !spans[tid - 1]) { continue; }
+            spans[tid - 1] = 0;
+            fprintf(f, ",\n{\"ph\":\"E\",\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d,\"args\":{\"left\":\"%s\",\"%s\":%d}}", us, frac, pid, tid, trace_names[e->type], trace_args[e->type], e->arg);
+            continue;
+        }
+        if ((e->type == TRACE_DISPATCH || e->type == TRACE_RESUME) && tid != 0) {
+            spans[tid - 1] = 1;
+            fprintf(f, ",\n{\"name\":");
+            jsonname(f, e->name);
+            fprintf(f, ",\"cat\":\"%s\",\"ph\":\"B\",\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d,\"args\":{\"pid\":%d}}", trace_names[e->type], us, frac, pid, tid, e->pid);
+        }
+        else {
+            // Stopping and continuing is every job at once
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"%c\",\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%d,\"args\":{\"pid\":%d,\"name\":", trace_names[e->type], (e->type == TRACE_STOP || e->type == TRACE_CONT) ? 'g' : 't', us, frac, pid, tid, e->pid);
+            jsonname(f, e->name);
+            fprintf(f, ",\"%s\":%d}}", trace_args[e->type], e->arg);
+        }
+        if (e->type == TRACE_ENQUEUE || e->type == TRACE_DISPATCH || e->type == TRACE_RESUME) {
+            fprintf(f, ",\n{\"name\":\"waiting\",\"ph\":\"C\",\"ts\":%llu.%03llu,\"pid\":%d,\"args\":{\"jobs\":%d}}", us, frac, pid, e->arg);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    free(spans);
+}